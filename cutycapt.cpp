@@ -10,26 +10,84 @@
 #include "cutycapt.hpp"
 
 #include <QApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
 #include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLockFile>
+#include <QMetaMethod>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QSet>
+#include <QTcpServer>
 #include <QWebEngineCertificateError>
 #include <QWebEngineProfile>
 #include <QWebEngineScriptCollection>
+#include <QBuffer>
 #include <QByteArray>
 #include <QFile>
 #include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
 #include <QPainter>
+#include <QProcess>
 #include <QPageLayout>
 #include <QSvgGenerator>
 #include <QTextStream>
 #include <QTimer>
+#include <QUuid>
 #include <QWebEngineHttpRequest>
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+#include <QWebEngineFrame>
+#endif
+#include <QWebEngineScript>
 #if CUTYCAPT_SCRIPT
 #include <QWebChannel>
-#include <QWebEngineScript>
 #endif
+#if CUTYCAPT_FONTCONFIG
+#include <fontconfig/fontconfig.h>
+#endif
+#if CUTYCAPT_ZLIB
+#include <zlib.h>
+#endif
+#if defined(Q_OS_LINUX)
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+#if CUTYCAPT_LIBJPEG
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+#if CUTYCAPT_JEMALLOC
+#include <jemalloc/jemalloc.h>
+#elif CUTYCAPT_MIMALLOC
+#include <mimalloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
 
 static struct _CutyExtMap {
 	CutyCapt::OutputFormat id;
@@ -43,222 +101,1763 @@ static struct _CutyExtMap {
 	{ CutyCapt::TiffFormat, ".tiff", "tiff" }, { CutyCapt::GifFormat, ".gif", "gif" },
 	{ CutyCapt::BmpFormat, ".bmp", "bmp" },    { CutyCapt::PpmFormat, ".ppm", "ppm" },
 	{ CutyCapt::XbmFormat, ".xbm", "xbm" },    { CutyCapt::XpmFormat, ".xpm", "xpm" },
+	{ CutyCapt::WebpFormat, ".webp", "webp" }, { CutyCapt::AutoFormat, ".auto", "auto" },
 	{ CutyCapt::OtherFormat, "", "" }
 };
 
 ////////////////////////////////////////////////////////////////////
-// CutyEnginePage (Qt6-correct overrides live here)
+// CutyMetrics
 ////////////////////////////////////////////////////////////////////
 
-CutyEnginePage::CutyEnginePage(QObject* parent) : QWebEnginePage(parent) {}
-
-void CutyEnginePage::handleCertificateError(QWebEngineCertificateError error) {
-	// If user didn't request insecure mode, do nothing (default rejection).
-	if (!mInsecure)
-		return;
+QElapsedTimer CutyMetrics::sClock;
+QJsonObject CutyMetrics::sValues;
 
-	// Accept only overridable errors.
-	if (error.isOverridable())
-		error.acceptCertificate();
+void CutyMetrics::start() {
+	sClock.start();
 }
 
-void CutyEnginePage::setUserAgent(const QString& userAgent) {
-	mUserAgent = userAgent;
-	profile()->setHttpUserAgent(userAgent);
+void CutyMetrics::set(const QString& key, const QJsonValue& value) {
+	sValues.insert(key, value);
 }
 
-void CutyEnginePage::setAlertString(const QString& alertString) {
-	mAlertString = alertString;
+void CutyMetrics::mark(const QString& key) {
+	sValues.insert(key, sClock.isValid() ? sClock.elapsed() : qint64(0));
 }
 
-QString CutyEnginePage::getAlertString() const {
-	return mAlertString;
+#if CUTYCAPT_JEMALLOC
+static size_t CaptMallctl(const QByteArray& name) {
+	size_t value = 0;
+	size_t len = sizeof(value);
+	if (mallctl(name.constData(), &value, &len, nullptr, 0) != 0)
+		return 0;
+	return value;
 }
+#endif
 
-void CutyEnginePage::setPrintAlerts(bool printAlerts) {
-	mPrintAlerts = printAlerts;
-}
+void CutyMetrics::heap(const QString& prefix) {
+#if CUTYCAPT_JEMALLOC
+	// Statistics are snapshots; bumping the epoch refreshes them.
+	uint64_t epoch = 1;
+	size_t len = sizeof(epoch);
+	mallctl("epoch", &epoch, &len, &epoch, len);
 
-void CutyEnginePage::setCutyCapt(CutyCapt* cutyCapt) {
-	mCutyCapt = cutyCapt;
-}
+	const size_t allocated = CaptMallctl("stats.allocated");
+	const size_t active = CaptMallctl("stats.active");
+	const size_t resident = CaptMallctl("stats.resident");
+	set(prefix + ".allocator", QStringLiteral("jemalloc"));
+	set(prefix + ".allocated", qint64(allocated));
+	set(prefix + ".active", qint64(active));
+	set(prefix + ".resident", qint64(resident));
+	set(prefix + ".mapped", qint64(CaptMallctl("stats.mapped")));
+	set(prefix + ".metadata", qint64(CaptMallctl("stats.metadata")));
+	if (resident > 0)
+		set(prefix + ".fragmentation", 1.0 - double(allocated) / double(resident));
 
-void CutyEnginePage::setInsecure(bool insecure) {
-	mInsecure = insecure;
-}
+	unsigned narenas = 0;
+	len = sizeof(narenas);
+	mallctl("arenas.narenas", &narenas, &len, nullptr, 0);
+	const size_t pageSize = CaptMallctl("arenas.page");
 
-QStringList CutyEnginePage::chooseFiles(FileSelectionMode /*mode*/, const QStringList& /*oldFiles*/,
-                                       const QStringList& /*acceptedMimeTypes*/) {
-	// Headless CLI tool: never open a file dialog.
-	return {};
+	QJsonArray arenas;
+	for (unsigned ix = 0; ix < narenas; ++ix) {
+		const QByteArray base = "stats.arenas." + QByteArray::number(ix) + ".";
+		const size_t pactive = CaptMallctl(base + "pactive");
+		if (pactive == 0)
+			continue;
+		QJsonObject arena;
+		arena.insert("arena", int(ix));
+		arena.insert("active", qint64(pactive * pageSize));
+		arena.insert("dirty", qint64(CaptMallctl(base + "pdirty") * pageSize));
+		arena.insert("small", qint64(CaptMallctl(base + "small.allocated")));
+		arena.insert("large", qint64(CaptMallctl(base + "large.allocated")));
+		arenas.append(arena);
+	}
+	set(prefix + ".arenas", arenas);
+#elif CUTYCAPT_MIMALLOC
+	size_t elapsed = 0, user = 0, sys = 0, rss = 0, peakRss = 0, commit = 0, peakCommit = 0,
+	       faults = 0;
+	mi_process_info(&elapsed, &user, &sys, &rss, &peakRss, &commit, &peakCommit, &faults);
+	set(prefix + ".allocator", QStringLiteral("mimalloc"));
+	set(prefix + ".resident", qint64(rss));
+	set(prefix + ".resident_peak", qint64(peakRss));
+	set(prefix + ".committed", qint64(commit));
+	set(prefix + ".committed_peak", qint64(peakCommit));
+	set(prefix + ".page_faults", qint64(faults));
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	const struct mallinfo2 mi = mallinfo2();
+	const size_t held = mi.arena + mi.hblkhd;
+	set(prefix + ".allocator", QStringLiteral("glibc"));
+	set(prefix + ".allocated", qint64(mi.uordblks + mi.hblkhd));
+	set(prefix + ".free", qint64(mi.fordblks));
+	set(prefix + ".mapped", qint64(mi.hblkhd));
+	set(prefix + ".resident", qint64(held));
+	if (held > 0)
+		set(prefix + ".fragmentation", double(mi.fordblks) / double(held));
+#else
+	set(prefix + ".allocator", QStringLiteral("system"));
+#endif
 }
 
-void CutyEnginePage::javaScriptAlert(const QUrl& /*securityOrigin*/, const QString& msg) {
-	if (mPrintAlerts) {
-		qDebug() << "[alert]" << msg;
-	}
+bool CutyMetrics::save(const QString& path) {
+	const QByteArray json = QJsonDocument(sValues).toJson(QJsonDocument::Indented);
 
-	// Preserve the "expect-alert triggers capture" behavior.
-	if (!mAlertString.isEmpty() && msg == mAlertString && mCutyCapt) {
-		QTimer::singleShot(10, mCutyCapt, SLOT(Delayed()));
+	if (path == "-") {
+		std::cout << json.constData() << std::flush;
+		return true;
 	}
-}
-
-bool CutyEnginePage::javaScriptConfirm(const QUrl& /*securityOrigin*/, const QString& /*msg*/) {
-	return true;
-}
 
-bool CutyEnginePage::javaScriptPrompt(const QUrl& /*securityOrigin*/, const QString& /*msg*/,
-                                     const QString& /*defaultValue*/, QString* result) {
-	if (result) *result = QString();
-	return true;
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	file.write(json);
+	return file.commit();
 }
 
 ////////////////////////////////////////////////////////////////////
-// CutyPage
+// Image processing
 ////////////////////////////////////////////////////////////////////
 
-CutyPage::CutyPage(QWidget* parent) : QWebEngineView(parent) {
-	mEnginePage = new CutyEnginePage(this);
-	setPage(mEnginePage);
-
-	// Qt6: TLS errors are delivered via signal; connect and optionally accept.
-	QObject::connect(mEnginePage, &QWebEnginePage::certificateError,
-	                 this, [this](QWebEngineCertificateError error) {
-		                 mEnginePage->handleCertificateError(error);
-	                 });
+// True if any channel of px differs from bg by more than tol.
+static inline bool CaptPixelDiffers(quint32 px, quint32 bg, int tol) {
+	for (int shift = 0; shift < 32; shift += 8) {
+		const int a = int((px >> shift) & 0xff);
+		const int b = int((bg >> shift) & 0xff);
+		if (std::abs(a - b) > tol)
+			return true;
+	}
+	return false;
 }
 
-void CutyPage::setAttribute(QWebEngineSettings::WebAttribute option, const QString& value) {
-	const bool on = (value == "on");
-	const bool off = (value == "off");
-	if (on || off)
-		settings()->setAttribute(option, on);
+// Index of the first pixel in px[0, n) that is not background, or n.
+static int CaptFirstForeground(const quint32* px, int n, quint32 bg, int tol) {
+	int ix = 0;
+#if defined(__SSE2__)
+	const __m128i vbg = _mm_set1_epi32(int(bg));
+	const __m128i vtol = _mm_set1_epi8(char(tol));
+	const __m128i zero = _mm_setzero_si128();
+	for (; ix + 8 <= n; ix += 8) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + ix));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + ix + 4));
+		const __m128i da = _mm_or_si128(_mm_subs_epu8(a, vbg), _mm_subs_epu8(vbg, a));
+		const __m128i db = _mm_or_si128(_mm_subs_epu8(b, vbg), _mm_subs_epu8(vbg, b));
+		const __m128i over = _mm_or_si128(_mm_subs_epu8(da, vtol), _mm_subs_epu8(db, vtol));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(over, zero)) != 0xffff)
+			break;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t vbg = vreinterpretq_u8_u32(vdupq_n_u32(bg));
+	const uint8x16_t vtol = vdupq_n_u8(uint8_t(tol));
+	for (; ix + 8 <= n; ix += 8) {
+		const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(px + ix));
+		const uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t*>(px + ix + 4));
+		const uint8x16_t over = vorrq_u8(vcgtq_u8(vabdq_u8(a, vbg), vtol), vcgtq_u8(vabdq_u8(b, vbg), vtol));
+		if (vmaxvq_u8(over) != 0)
+			break;
+	}
+#endif
+	for (; ix < n; ++ix) {
+		if (CaptPixelDiffers(px[ix], bg, tol))
+			return ix;
+	}
+	return n;
 }
 
-void CutyPage::setAttribute(Qt::WidgetAttribute option, bool value) {
-	QWidget::setAttribute(option, value);
+// Index of the last pixel in px[0, n) that is not background, or -1.
+static int CaptLastForeground(const quint32* px, int n, quint32 bg, int tol) {
+	int ix = n;
+#if defined(__SSE2__)
+	const __m128i vbg = _mm_set1_epi32(int(bg));
+	const __m128i vtol = _mm_set1_epi8(char(tol));
+	const __m128i zero = _mm_setzero_si128();
+	for (; ix >= 8; ix -= 8) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + ix - 8));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px + ix - 4));
+		const __m128i da = _mm_or_si128(_mm_subs_epu8(a, vbg), _mm_subs_epu8(vbg, a));
+		const __m128i db = _mm_or_si128(_mm_subs_epu8(b, vbg), _mm_subs_epu8(vbg, b));
+		const __m128i over = _mm_or_si128(_mm_subs_epu8(da, vtol), _mm_subs_epu8(db, vtol));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(over, zero)) != 0xffff)
+			break;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t vbg = vreinterpretq_u8_u32(vdupq_n_u32(bg));
+	const uint8x16_t vtol = vdupq_n_u8(uint8_t(tol));
+	for (; ix >= 8; ix -= 8) {
+		const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(px + ix - 8));
+		const uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t*>(px + ix - 4));
+		const uint8x16_t over = vorrq_u8(vcgtq_u8(vabdq_u8(a, vbg), vtol), vcgtq_u8(vabdq_u8(b, vbg), vtol));
+		if (vmaxvq_u8(over) != 0)
+			break;
+	}
+#endif
+	while (ix > 0) {
+		if (CaptPixelDiffers(px[--ix], bg, tol))
+			return ix;
+	}
+	return -1;
 }
 
-void CutyPage::setUserAgent(const QString& userAgent) {
-	mEnginePage->setUserAgent(userAgent);
-}
+// Bounding box of everything that differs from the top-left pixel by more
+// than tol per channel (the same reference ImageMagick's -trim uses).
+// Expects a 32-bit image; returns a null rect for a uniform image.
+static QRect CaptContentRect(const QImage& image, int tol) {
+	const int w = image.width();
+	const int h = image.height();
+	const auto row = [&image](int y) {
+		return reinterpret_cast<const quint32*>(image.constScanLine(y));
+	};
+	const quint32 bg = row(0)[0];
 
-void CutyPage::setAlertString(const QString& alertString) {
-	mEnginePage->setAlertString(alertString);
-}
+	int top = 0;
+	while (top < h && CaptFirstForeground(row(top), w, bg, tol) == w)
+		++top;
+	if (top == h)
+		return QRect();
 
-QString CutyPage::getAlertString() const {
-	return mEnginePage->getAlertString();
-}
+	int bottom = h - 1;
+	while (bottom > top && CaptFirstForeground(row(bottom), w, bg, tol) == w)
+		--bottom;
 
-void CutyPage::setPrintAlerts(bool printAlerts) {
-	mEnginePage->setPrintAlerts(printAlerts);
-}
+	// Each row only needs scanning outside the box found so far.
+	int left = w;
+	int right = -1;
+	for (int y = top; y <= bottom; ++y) {
+		const quint32* px = row(y);
+		left = CaptFirstForeground(px, left, bg, tol);
+		const int last = CaptLastForeground(px + right + 1, w - right - 1, bg, tol);
+		if (last >= 0)
+			right += 1 + last;
+	}
 
-void CutyPage::setCutyCapt(CutyCapt* cutyCapt) {
-	mEnginePage->setCutyCapt(cutyCapt);
+	return QRect(QPoint(left, top), QPoint(right, bottom));
 }
 
-void CutyPage::setInsecure(bool insecure) {
-	mEnginePage->setInsecure(insecure);
+// Palette stored as padded float planes so the nearest-colour search can
+// compare four entries per step.
+struct CaptPalette {
+	std::vector<float> r, g, b;
+	int size{ 0 };
+
+	void assign(const std::vector<QRgb>& colors) {
+		size = int(colors.size());
+		const int padded = (size + 3) & ~3;
+		r.assign(padded, 1e9f);
+		g.assign(padded, 1e9f);
+		b.assign(padded, 1e9f);
+		for (int ix = 0; ix < size; ++ix) {
+			r[ix] = float(qRed(colors[ix]));
+			g[ix] = float(qGreen(colors[ix]));
+			b[ix] = float(qBlue(colors[ix]));
+		}
+	}
+
+	int nearest(float cr, float cg, float cb) const {
+		int best = 0;
+		float bestDist = 3e38f;
+		int ix = 0;
+#if defined(__SSE2__)
+		const __m128 vr = _mm_set1_ps(cr);
+		const __m128 vg = _mm_set1_ps(cg);
+		const __m128 vb = _mm_set1_ps(cb);
+		__m128 vmin = _mm_set1_ps(3e38f);
+		__m128i vbest = _mm_setzero_si128();
+		__m128i vidx = _mm_setr_epi32(0, 1, 2, 3);
+		const __m128i four = _mm_set1_epi32(4);
+		for (; ix < int(r.size()); ix += 4) {
+			const __m128 dr = _mm_sub_ps(_mm_loadu_ps(&r[ix]), vr);
+			const __m128 dg = _mm_sub_ps(_mm_loadu_ps(&g[ix]), vg);
+			const __m128 db = _mm_sub_ps(_mm_loadu_ps(&b[ix]), vb);
+			const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+			                            _mm_mul_ps(db, db));
+			const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, vmin));
+			vbest = _mm_or_si128(_mm_and_si128(closer, vidx), _mm_andnot_si128(closer, vbest));
+			vmin = _mm_min_ps(d, vmin);
+			vidx = _mm_add_epi32(vidx, four);
+		}
+		alignas(16) float mins[4];
+		alignas(16) int idxs[4];
+		_mm_store_ps(mins, vmin);
+		_mm_store_si128(reinterpret_cast<__m128i*>(idxs), vbest);
+		for (int lane = 0; lane < 4; ++lane) {
+			if (mins[lane] < bestDist || (mins[lane] == bestDist && idxs[lane] < best)) {
+				bestDist = mins[lane];
+				best = idxs[lane];
+			}
+		}
+#else
+		for (; ix < size; ++ix) {
+			const float dr = r[ix] - cr;
+			const float dg = g[ix] - cg;
+			const float db = b[ix] - cb;
+			const float d = dr * dr + dg * dg + db * db;
+			if (d < bestDist) {
+				bestDist = d;
+				best = ix;
+			}
+		}
+#endif
+		return best;
+	}
+};
+
+// Colours of the image if there are at most maxColors of them.
+static bool CaptExactColors(const QImage& image, int maxColors, std::vector<QRgb>& colors) {
+	// Open addressing; sized well above 256 entries so probes stay short.
+	constexpr int kSlots = 1024;
+	quint32 keys[kSlots];
+	bool used[kSlots] = {};
+	colors.clear();
+
+	quint32 last = 0;
+	bool haveLast = false;
+	for (int y = 0; y < image.height(); ++y) {
+		const quint32* px = reinterpret_cast<const quint32*>(image.constScanLine(y));
+		for (int x = 0; x < image.width(); ++x) {
+			const quint32 c = px[x] | 0xff000000u;
+			if (haveLast && c == last)
+				continue;
+			last = c;
+			haveLast = true;
+
+			int slot = int((c * 2654435761u) >> 22);
+			while (used[slot] && keys[slot] != c)
+				slot = (slot + 1) & (kSlots - 1);
+			if (used[slot])
+				continue;
+			if (int(colors.size()) == maxColors)
+				return false;
+			used[slot] = true;
+			keys[slot] = c;
+			colors.push_back(c);
+		}
+	}
+	return true;
 }
 
-#if CUTYCAPT_SCRIPT
-// Install a WebChannel bridge object into the JS environment as window[scriptObjectName]
-// and inject user script source at DocumentReady.
-void CutyPage::installScriptSupport(const QString& scriptObjectName,
-                                    const QString& injectedUserScriptSource,
-                                    bool silent) {
-	if (!mChannel) {
-		mChannel = new QWebChannel(this);
-		mBridge = new CutyScriptBridge(this);
+// Median cut over a 15-bit histogram, refined with a few k-means rounds.
+static std::vector<QRgb> CaptPaletteFor(const QImage& image, int maxColors) {
+	struct Bin {
+		float r, g, b, w;
+	};
 
-		// Register the object under a stable internal name.
-		// We then alias it to window[scriptObjectName] in JS.
-		mChannel->registerObject(QStringLiteral("cuty"), mBridge);
-		page()->setWebChannel(mChannel);
+	// Sample at most ~1M pixels; screenshots are highly redundant.
+	const qint64 pixels = qint64(image.width()) * image.height();
+	const int step = int(qMax<qint64>(1, pixels / (1 << 20)));
 
-		// Optional: let scripts print to stderr via cuty.jsLog("...")
-		QObject::connect(mBridge, &CutyScriptBridge::log, this, [silent](const QString& msg) {
-			if (!silent)
-				std::clog << "[script] " << msg.toStdString() << std::endl;
-		});
+	std::vector<quint32> count(1 << 15, 0);
+	std::vector<quint64> sum(3 << 15, 0);
+	qint64 ix = 0;
+	for (int y = 0; y < image.height(); ++y) {
+		const quint32* px = reinterpret_cast<const quint32*>(image.constScanLine(y));
+		for (int x = int(ix % step); x < image.width(); x += step) {
+			const quint32 c = px[x];
+			const int key = int(((c >> 9) & 0x7c00) | ((c >> 6) & 0x03e0) | ((c >> 3) & 0x001f));
+			++count[key];
+			sum[3 * key] += qRed(c);
+			sum[3 * key + 1] += qGreen(c);
+			sum[3 * key + 2] += qBlue(c);
+		}
+		ix += image.width();
 	}
 
-	const QString objName = scriptObjectName.isEmpty() ? QStringLiteral("cuty") : scriptObjectName;
+	std::vector<Bin> bins;
+	for (int key = 0; key < (1 << 15); ++key) {
+		if (count[key] == 0)
+			continue;
+		const float w = float(count[key]);
+		bins.push_back({ float(sum[3 * key]) / w, float(sum[3 * key + 1]) / w,
+		                 float(sum[3 * key + 2]) / w, w });
+	}
 
-	// 1) Bootstrap: load qwebchannel.js and expose bridge as window[objName]
-	const QString bootstrap = QStringLiteral(R"(
-		(function() {
-			function boot() {
-				if (typeof QWebChannel === 'undefined') {
-					// qwebchannel.js not loaded yet
-					return false;
+	// Median cut: split the heaviest, widest box at its weighted median.
+	struct Box {
+		int begin, end;
+	};
+	std::vector<Box> boxes{ { 0, int(bins.size()) } };
+	const auto channel = [](const Bin& bin, int c) { return c == 0 ? bin.r : c == 1 ? bin.g : bin.b; };
+	while (int(boxes.size()) < maxColors) {
+		int pick = -1;
+		int pickChannel = 0;
+		float pickScore = 0;
+		for (int bx = 0; bx < int(boxes.size()); ++bx) {
+			const Box& box = boxes[bx];
+			if (box.end - box.begin < 2)
+				continue;
+			float lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 }, w = 0;
+			for (int i = box.begin; i < box.end; ++i) {
+				for (int c = 0; c < 3; ++c) {
+					lo[c] = qMin(lo[c], channel(bins[i], c));
+					hi[c] = qMax(hi[c], channel(bins[i], c));
 				}
-				new QWebChannel(qt.webChannelTransport, function(channel) {
-					window.%1 = channel.objects.cuty;
-				});
-				return true;
+				w += bins[i].w;
 			}
+			for (int c = 0; c < 3; ++c) {
+				const float score = (hi[c] - lo[c]) * std::sqrt(w);
+				if (score > pickScore) {
+					pick = bx;
+					pickChannel = c;
+					pickScore = score;
+				}
+			}
+		}
+		if (pick < 0)
+			break;
 
-			// If already loaded, just boot
-			if (typeof qt !== 'undefined' && qt.webChannelTransport) {
-				if (boot()) return;
+		const Box box = boxes[pick];
+		std::sort(bins.begin() + box.begin, bins.begin() + box.end,
+		          [&](const Bin& a, const Bin& b) { return channel(a, pickChannel) < channel(b, pickChannel); });
+		float total = 0;
+		for (int i = box.begin; i < box.end; ++i)
+			total += bins[i].w;
+		float acc = 0;
+		int split = box.begin + 1;
+		for (int i = box.begin; i < box.end - 1; ++i) {
+			acc += bins[i].w;
+			split = i + 1;
+			if (acc >= total / 2)
+				break;
+		}
+		boxes[pick] = { box.begin, split };
+		boxes.push_back({ split, box.end });
+	}
+
+	std::vector<QRgb> colors;
+	for (const Box& box : boxes) {
+		double r = 0, g = 0, b = 0, w = 0;
+		for (int i = box.begin; i < box.end; ++i) {
+			r += double(bins[i].r) * bins[i].w;
+			g += double(bins[i].g) * bins[i].w;
+			b += double(bins[i].b) * bins[i].w;
+			w += bins[i].w;
+		}
+		if (w > 0)
+			colors.push_back(qRgb(int(r / w + 0.5), int(g / w + 0.5), int(b / w + 0.5)));
+	}
+
+	// Lloyd iterations pull the entries towards the heavy bins.
+	CaptPalette palette;
+	for (int round = 0; round < 3 && !colors.empty(); ++round) {
+		palette.assign(colors);
+		std::vector<double> acc(4 * colors.size(), 0.0);
+		for (const Bin& bin : bins) {
+			const int n = palette.nearest(bin.r, bin.g, bin.b);
+			acc[4 * n] += double(bin.r) * bin.w;
+			acc[4 * n + 1] += double(bin.g) * bin.w;
+			acc[4 * n + 2] += double(bin.b) * bin.w;
+			acc[4 * n + 3] += bin.w;
+		}
+		for (size_t n = 0; n < colors.size(); ++n) {
+			const double w = acc[4 * n + 3];
+			if (w > 0) {
+				colors[n] = qRgb(int(acc[4 * n] / w + 0.5), int(acc[4 * n + 1] / w + 0.5),
+				                 int(acc[4 * n + 2] / w + 0.5));
 			}
+		}
+	}
 
-			// Load qwebchannel.js from Qt resource
-			var s = document.createElement('script');
-			s.src = 'qrc:///qtwebchannel/qwebchannel.js';
-			s.onload = function() { boot(); };
-			(document.head || document.documentElement).appendChild(s);
-		})();
-	)").arg(objName);
+	return colors;
+}
 
-	QWebEngineScript bootScript;
-	bootScript.setName(QStringLiteral("cutycapt-webchannel-bootstrap"));
-	bootScript.setInjectionPoint(QWebEngineScript::DocumentReady);
-	bootScript.setRunsOnSubFrames(true);
-	bootScript.setWorldId(QWebEngineScript::MainWorld);
-	bootScript.setSourceCode(bootstrap);
-	page()->scripts().insert(bootScript);
+// Reduce a 32-bit image to an indexed one with at most maxColors entries.
+// Images that already fit keep their exact colours (lossless PNG8), which
+// is reported through exact.
+static QImage CaptQuantize(const QImage& source, int maxColors, bool dither,
+                           bool* exact = nullptr) {
+	if (source.isNull())
+		return source;
 
-	// 2) Inject user script (if provided)
-	if (!injectedUserScriptSource.trimmed().isEmpty()) {
-		QWebEngineScript userScript;
-		userScript.setName(QStringLiteral("cutycapt-user-injected-script"));
-		userScript.setInjectionPoint(QWebEngineScript::DocumentReady);
-		userScript.setRunsOnSubFrames(true);
-		userScript.setWorldId(QWebEngineScript::MainWorld);
-		userScript.setSourceCode(injectedUserScriptSource);
-		page()->scripts().insert(userScript);
+	const QImage image = source.depth() == 32 && !source.hasAlphaChannel()
+	                         ? source
+	                         : source.convertToFormat(QImage::Format_RGB32);
+	const int w = image.width();
+	const int h = image.height();
+	maxColors = qBound(2, maxColors, 256);
+
+	std::vector<QRgb> colors;
+	const bool fits = CaptExactColors(image, maxColors, colors);
+	if (!fits)
+		colors = CaptPaletteFor(image, maxColors);
+
+	QImage out(w, h, QImage::Format_Indexed8);
+	QVector<QRgb> table(colors.begin(), colors.end());
+	out.setColorTable(table);
+
+	CaptPalette palette;
+	palette.assign(colors);
+
+	if (exact)
+		*exact = fits;
+	if (fits) {
+		for (int y = 0; y < h; ++y) {
+			const quint32* px = reinterpret_cast<const quint32*>(image.constScanLine(y));
+			uchar* dst = out.scanLine(y);
+			quint32 last = px[0] | 0xff000000u;
+			uchar lastIndex = uchar(palette.nearest(qRed(last), qGreen(last), qBlue(last)));
+			for (int x = 0; x < w; ++x) {
+				const quint32 c = px[x] | 0xff000000u;
+				if (c != last) {
+					last = c;
+					lastIndex = uchar(palette.nearest(qRed(c), qGreen(c), qBlue(c)));
+				}
+				dst[x] = lastIndex;
+			}
+		}
+		return out;
 	}
+
+	// 15-bit colour -> palette index, filled on first use.
+	std::vector<qint16> cache(1 << 15, -1);
+	const auto lookup = [&](int r, int g, int b) {
+		const int key = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+		if (cache[key] < 0)
+			cache[key] = qint16(palette.nearest(float(r | 4), float(g | 4), float(b | 4)));
+		return int(cache[key]);
+	};
+
+	// Floyd-Steinberg error for the current and next row, in 1/16 units.
+	std::vector<int> err(dither ? 6 * (w + 2) : 0, 0);
+	for (int y = 0; y < h; ++y) {
+		const quint32* px = reinterpret_cast<const quint32*>(image.constScanLine(y));
+		uchar* dst = out.scanLine(y);
+		if (!dither) {
+			for (int x = 0; x < w; ++x)
+				dst[x] = uchar(lookup(qRed(px[x]), qGreen(px[x]), qBlue(px[x])));
+			continue;
+		}
+
+		int* cur = &err[(y & 1) * 3 * (w + 2)];
+		int* next = &err[((y + 1) & 1) * 3 * (w + 2)];
+		std::fill(next, next + 3 * (w + 2), 0);
+		for (int x = 0; x < w; ++x) {
+			const int* e = cur + 3 * (x + 1);
+			const int r = qBound(0, qRed(px[x]) + (e[0] + 8) / 16, 255);
+			const int g = qBound(0, qGreen(px[x]) + (e[1] + 8) / 16, 255);
+			const int b = qBound(0, qBlue(px[x]) + (e[2] + 8) / 16, 255);
+			const int n = lookup(r, g, b);
+			dst[x] = uchar(n);
+
+			const int d[3] = { r - qRed(colors[n]), g - qGreen(colors[n]), b - qBlue(colors[n]) };
+			for (int c = 0; c < 3; ++c) {
+				cur[3 * (x + 2) + c] += d[c] * 7;
+				next[3 * x + c] += d[c] * 3;
+				next[3 * (x + 1) + c] += d[c] * 5;
+				next[3 * (x + 2) + c] += d[c];
+			}
+		}
+	}
+
+	return out;
 }
-#endif
 
-////////////////////////////////////////////////////////////////////
-// CutyCapt
-////////////////////////////////////////////////////////////////////
+// Minimal GIF89a writer for an indexed image (Qt only reads GIF).
+static QByteArray CaptEncodeGif(const QImage& image) {
+	const QVector<QRgb> table = image.colorTable();
+	const int w = image.width();
+	const int h = image.height();
 
-CutyCapt::CutyCapt(CutyPage* page, const QString& output, int delay, OutputFormat format,
-                   const QString& scriptProp, const QString& scriptCode, bool insecure, bool smooth,
-                   bool silent)
-	: mOutput(output),
-	  mDelay(delay),
-	  mPage(page),
-	  mFormat(format),
-	  mScriptObj(new QObject()),
-	  mScriptProp(scriptProp),
-	  mScriptCode(scriptCode),
-	  mInsecure(insecure),
-	  mSmooth(smooth),
-	  mSilent(silent) {
-	mPage->setCutyCapt(this);
-	mPage->setInsecure(insecure);
+	int bits = 1;
+	while ((1 << bits) < table.size())
+		++bits;
+	const int minCodeSize = qMax(2, bits);
 
-#if CUTYCAPT_SCRIPT
-	wireScriptSignals();
-#endif
+	QByteArray gif("GIF89a");
+	const auto put16 = [&gif](int v) {
+		gif.append(char(v & 0xff));
+		gif.append(char((v >> 8) & 0xff));
+	};
+	put16(w);
+	put16(h);
+	gif.append(char(0x80 | ((bits - 1) << 4) | (bits - 1)));
+	gif.append(char(0));
+	gif.append(char(0));
+	for (int ix = 0; ix < (1 << bits); ++ix) {
+		const QRgb c = ix < table.size() ? table[ix] : 0;
+		gif.append(char(qRed(c)));
+		gif.append(char(qGreen(c)));
+		gif.append(char(qBlue(c)));
+	}
+
+	gif.append(char(0x2c));
+	put16(0);
+	put16(0);
+	put16(w);
+	put16(h);
+	gif.append(char(0));
+	gif.append(char(minCodeSize));
+
+	// LZW, LSB-first codes packed into sub-blocks of up to 255 bytes.
+	const int clearCode = 1 << minCodeSize;
+	const int eoiCode = clearCode + 1;
+	int codeSize = minCodeSize + 1;
+	int nextCode = eoiCode + 1;
+
+	QByteArray block;
+	quint32 acc = 0;
+	int accBits = 0;
+	const auto flushBlock = [&]() {
+		gif.append(char(block.size()));
+		gif.append(block);
+		block.clear();
+	};
+	const auto putCode = [&](int code) {
+		acc |= quint32(code) << accBits;
+		accBits += codeSize;
+		while (accBits >= 8) {
+			block.append(char(acc & 0xff));
+			acc >>= 8;
+			accBits -= 8;
+			if (block.size() == 255)
+				flushBlock();
+		}
+		// The decoder widens its codes once the next free code no longer fits.
+		if (nextCode >= (1 << codeSize) && codeSize < 12)
+			++codeSize;
+	};
+
+	// (prefix << 8 | byte) -> code, open addressing.
+	constexpr int kSlots = 1 << 13;
+	std::vector<qint32> keys(kSlots, -1);
+	std::vector<qint16> codes(kSlots, 0);
+
+	putCode(clearCode);
+	int prefix = -1;
+	for (int y = 0; y < h; ++y) {
+		const uchar* px = image.constScanLine(y);
+		for (int x = 0; x < w; ++x) {
+			const int c = px[x];
+			if (prefix < 0) {
+				prefix = c;
+				continue;
+			}
+
+			const qint32 key = (prefix << 8) | c;
+			int slot = int((quint32(key) * 2654435761u) >> 19);
+			while (keys[slot] >= 0 && keys[slot] != key)
+				slot = (slot + 1) & (kSlots - 1);
+			if (keys[slot] == key) {
+				prefix = codes[slot];
+				continue;
+			}
+
+			putCode(prefix);
+			if (nextCode < 4095) {
+				keys[slot] = key;
+				codes[slot] = qint16(nextCode++);
+			} else {
+				putCode(clearCode);
+				std::fill(keys.begin(), keys.end(), -1);
+				codeSize = minCodeSize + 1;
+				nextCode = eoiCode + 1;
+			}
+			prefix = c;
+		}
+	}
+	if (prefix >= 0)
+		putCode(prefix);
+	putCode(eoiCode);
+	if (accBits > 0)
+		block.append(char(acc & 0xff));
+	if (!block.isEmpty())
+		flushBlock();
+	gif.append(char(0));
+	gif.append(char(0x3b));
+
+	return gif;
+}
+
+// ARGB32 -> 8-bit luma (BT.601 weights 77/150/29 in 1/256 units).
+static void CaptGrayRow(const quint32* src, uchar* dst, int n) {
+	int ix = 0;
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128i wr = _mm_set1_epi32(77);
+	const __m128i wg = _mm_set1_epi32(150);
+	const __m128i wb = _mm_set1_epi32(29);
+	const __m128i half = _mm_set1_epi32(128);
+	for (; ix + 8 <= n; ix += 8) {
+		__m128i y[2];
+		for (int half8 = 0; half8 < 2; ++half8) {
+			const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + ix + 4 * half8));
+			const __m128i r = _mm_and_si128(_mm_srli_epi32(px, 16), mask);
+			const __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+			const __m128i b = _mm_and_si128(px, mask);
+			// Products stay below 2^16, so 16-bit multiplies are exact.
+			const __m128i sum = _mm_add_epi32(
+				_mm_add_epi32(_mm_mullo_epi16(r, wr), _mm_mullo_epi16(g, wg)),
+				_mm_add_epi32(_mm_mullo_epi16(b, wb), half));
+			y[half8] = _mm_srli_epi32(sum, 8);
+		}
+		const __m128i packed16 = _mm_packs_epi32(y[0], y[1]);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + ix), _mm_packus_epi16(packed16, packed16));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (; ix + 8 <= n; ix += 8) {
+		const uint8x8x4_t px = vld4_u8(reinterpret_cast<const uint8_t*>(src + ix));
+		// Little-endian ARGB32 is stored as B, G, R, A.
+		uint16x8_t sum = vmull_u8(px.val[2], vdup_n_u8(77));
+		sum = vmlal_u8(sum, px.val[1], vdup_n_u8(150));
+		sum = vmlal_u8(sum, px.val[0], vdup_n_u8(29));
+		vst1_u8(dst + ix, vrshrn_n_u16(sum, 8));
+	}
+#endif
+	for (; ix < n; ++ix) {
+		const quint32 c = src[ix];
+		dst[ix] = uchar((qRed(c) * 77 + qGreen(c) * 150 + qBlue(c) * 29 + 128) >> 8);
+	}
+}
+
+// Global threshold maximising between-class variance.
+static int CaptOtsuThreshold(const QImage& gray) {
+	qint64 hist[256] = {};
+	for (int y = 0; y < gray.height(); ++y) {
+		const uchar* px = gray.constScanLine(y);
+		for (int x = 0; x < gray.width(); ++x)
+			++hist[px[x]];
+	}
+
+	const double total = double(gray.width()) * gray.height();
+	double sumAll = 0;
+	for (int t = 0; t < 256; ++t)
+		sumAll += double(t) * hist[t];
+
+	double sumBack = 0;
+	double weightBack = 0;
+	double bestVar = -1;
+	int best = 128;
+	for (int t = 0; t < 256; ++t) {
+		weightBack += hist[t];
+		if (weightBack == 0)
+			continue;
+		const double weightFore = total - weightBack;
+		if (weightFore == 0)
+			break;
+		sumBack += double(t) * hist[t];
+		const double meanBack = sumBack / weightBack;
+		const double meanFore = (sumAll - sumBack) / weightFore;
+		const double var = weightBack * weightFore * (meanBack - meanFore) * (meanBack - meanFore);
+		if (var > bestVar) {
+			bestVar = var;
+			best = t;
+		}
+	}
+	return best;
+}
+
+// Pack one row of gray values into MSB-first bits (1 = white).
+static void CaptThresholdRow(const uchar* gray, uchar* bits, int n, int threshold) {
+	static const auto reversed = [] {
+		std::array<uchar, 256> table{};
+		for (int v = 0; v < 256; ++v) {
+			int r = 0;
+			for (int bit = 0; bit < 8; ++bit)
+				r |= ((v >> bit) & 1) << (7 - bit);
+			table[v] = uchar(r);
+		}
+		return table;
+	}();
+
+	int ix = 0;
+#if defined(__SSE2__)
+	// Unsigned compare via the signed one on values biased by 0x80.
+	const __m128i bias = _mm_set1_epi8(char(0x80));
+	const __m128i limit = _mm_set1_epi8(char(threshold ^ 0x80));
+	for (; ix + 16 <= n; ix += 16) {
+		const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gray + ix)), bias);
+		const int mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, limit));
+		bits[ix / 8] = reversed[mask & 0xff];
+		bits[ix / 8 + 1] = reversed[(mask >> 8) & 0xff];
+	}
+#endif
+	for (; ix < n; ix += 8) {
+		uchar byte = 0;
+		for (int bit = 0; bit < 8 && ix + bit < n; ++bit) {
+			if (gray[ix + bit] > threshold)
+				byte |= uchar(0x80 >> bit);
+		}
+		bits[ix / 8] = byte;
+	}
+}
+
+// Bradley-Roth local mean threshold: a pixel is black when it is more than
+// 15% darker than its (width/16)^2 neighbourhood. Uses O(width) memory.
+static void CaptAdaptiveThreshold(const QImage& gray, QImage& mono) {
+	const int w = gray.width();
+	const int h = gray.height();
+	const int radius = qMax(4, w / 32);
+	std::vector<quint32> column(w, 0);
+	std::vector<quint64> prefix(w + 1, 0);
+
+	// Column sums start out covering rows [0, radius).
+	for (int y = 0; y < qMin(radius, h); ++y) {
+		const uchar* px = gray.constScanLine(y);
+		for (int x = 0; x < w; ++x)
+			column[x] += px[x];
+	}
+
+	for (int y = 0; y < h; ++y) {
+		if (y + radius < h) {
+			const uchar* px = gray.constScanLine(y + radius);
+			for (int x = 0; x < w; ++x)
+				column[x] += px[x];
+		}
+		if (y - radius - 1 >= 0) {
+			const uchar* px = gray.constScanLine(y - radius - 1);
+			for (int x = 0; x < w; ++x)
+				column[x] -= px[x];
+		}
+		const qint64 rows = qMin(h - 1, y + radius) - qMax(0, y - radius) + 1;
+
+		for (int x = 0; x < w; ++x)
+			prefix[x + 1] = prefix[x] + column[x];
+
+		const uchar* px = gray.constScanLine(y);
+		uchar* bits = mono.scanLine(y);
+		std::fill(bits, bits + (w + 7) / 8, uchar(0));
+		for (int x = 0; x < w; ++x) {
+			const int x0 = qMax(0, x - radius);
+			const int x1 = qMin(w - 1, x + radius);
+			const quint64 sum = prefix[x1 + 1] - prefix[x0];
+			const quint64 count = quint64(rows) * quint64(x1 - x0 + 1);
+			if (quint64(px[x]) * count * 100 > sum * 85)
+				bits[x / 8] |= uchar(0x80 >> (x & 7));
+		}
+	}
+}
+
+static QImage CaptGrayscale(const QImage& source) {
+	const QImage image = source.depth() == 32 ? source : source.convertToFormat(QImage::Format_RGB32);
+	QImage gray(image.size(), QImage::Format_Grayscale8);
+	for (int y = 0; y < image.height(); ++y) {
+		CaptGrayRow(reinterpret_cast<const quint32*>(image.constScanLine(y)), gray.scanLine(y),
+		            image.width());
+	}
+	return gray;
+}
+
+// chosen receives the threshold Otsu's method picked, if asked to.
+static QImage CaptBilevel(const QImage& source, int threshold, int* chosen = nullptr) {
+	const QImage gray = CaptGrayscale(source);
+	QImage mono(gray.size(), QImage::Format_Mono);
+	mono.setColorTable(QVector<QRgb>{ qRgb(0, 0, 0), qRgb(255, 255, 255) });
+
+	if (threshold == CutyCapt::AdaptiveThreshold) {
+		CaptAdaptiveThreshold(gray, mono);
+		return mono;
+	}
+
+	if (threshold == CutyCapt::OtsuThreshold)
+		threshold = CaptOtsuThreshold(gray);
+	if (chosen)
+		*chosen = threshold;
+
+	for (int y = 0; y < gray.height(); ++y)
+		CaptThresholdRow(gray.constScanLine(y), mono.scanLine(y), gray.width(), threshold);
+	return mono;
+}
+
+// 64-bit pHash: DCT of a 32x32 luma thumbnail, low 8x8 frequencies
+// compared against their median. The DC term only follows the average
+// brightness, so it is left out of the median and its bit stays 0.
+static quint64 CaptPerceptualHash(const QImage& image) {
+	constexpr int kSize = 32;
+	constexpr int kLow = 8;
+
+	const QImage small = CaptGrayscale(
+		image.scaled(kSize, kSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+
+	static const auto basis = [] {
+		std::array<std::array<float, kSize>, kLow> c{};
+		for (int u = 0; u < kLow; ++u) {
+			for (int x = 0; x < kSize; ++x)
+				c[u][x] = float(std::cos((2 * x + 1) * u * M_PI / (2 * kSize)));
+		}
+		return c;
+	}();
+
+	// Separable DCT restricted to the needed rows: T = C * P, D = T * C^T.
+	// The inner loops run over contiguous floats and vectorize.
+	float pixels[kSize][kSize];
+	for (int y = 0; y < kSize; ++y) {
+		const uchar* px = small.constScanLine(y);
+		for (int x = 0; x < kSize; ++x)
+			pixels[y][x] = float(px[x]);
+	}
+
+	float rows[kLow][kSize] = {};
+	for (int u = 0; u < kLow; ++u) {
+		for (int y = 0; y < kSize; ++y) {
+			const float cu = basis[u][y];
+			for (int x = 0; x < kSize; ++x)
+				rows[u][x] += cu * pixels[y][x];
+		}
+	}
+
+	float coeffs[kLow * kLow];
+	for (int u = 0; u < kLow; ++u) {
+		for (int v = 0; v < kLow; ++v) {
+			float sum = 0;
+			for (int x = 0; x < kSize; ++x)
+				sum += rows[u][x] * basis[v][x];
+			coeffs[u * kLow + v] = sum;
+		}
+	}
+
+	constexpr int kAc = kLow * kLow - 1;
+	float sorted[kAc];
+	std::copy(coeffs + 1, coeffs + kLow * kLow, sorted);
+	std::nth_element(sorted, sorted + kAc / 2, sorted + kAc);
+	const float median = sorted[kAc / 2];
+
+	quint64 hash = 0;
+	for (int ix = 1; ix < kLow * kLow; ++ix) {
+		if (coeffs[ix] > median)
+			hash |= quint64(1) << ix;
+	}
+	return hash;
+}
+
+// 64-bit dHash: horizontal gradient signs of a 9x8 luma thumbnail.
+static quint64 CaptDifferenceHash(const QImage& image) {
+	const QImage small =
+		CaptGrayscale(image.scaled(9, 8, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+
+	quint64 hash = 0;
+	for (int y = 0; y < 8; ++y) {
+		const uchar* px = small.constScanLine(y);
+		for (int x = 0; x < 8; ++x) {
+			if (px[x] < px[x + 1])
+				hash |= quint64(1) << (y * 8 + x);
+		}
+	}
+	return hash;
+}
+
+// Multi-index hashing: split into distance + 1 bands, a hash within
+// distance of another equals it in at least one band. At least six bands
+// keep each band, and so the number of buckets per band, small.
+static QStringList CaptHashBuckets(quint64 hash, int distance) {
+	const int bands = qBound(6, distance + 1, 64);
+	QStringList buckets;
+	int shift = 0;
+	for (int band = 0; band < bands; ++band) {
+		const int width = (64 - shift) / (bands - band);
+		const quint64 value = (hash >> shift) & ((quint64(1) << width) - 1);
+		buckets.append(QStringLiteral("%1-%2").arg(band).arg(value, 0, 16));
+		shift += width;
+	}
+	return buckets;
+}
+
+// Append an index line to the bucket of each of its bands.
+static void CaptFileHashEntry(const QDir& dir, const QByteArray& line, int distance) {
+	bool ok = false;
+	const quint64 hash = line.left(line.indexOf(' ')).toULongLong(&ok, 16);
+	if (!ok)
+		return;
+	for (const QString& name : CaptHashBuckets(hash, distance)) {
+		QFile bucket(dir.filePath(name));
+		if (bucket.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+			bucket.write(line);
+	}
+}
+
+// Share of sampled 8x8 blocks that look photographic (many colours, soft
+// transitions) and share of hard luma edges; flat areas and text have few
+// colours or hard edges. Expects a 32-bit image.
+static void CaptAnalyze(const QImage& image, double& photoFraction, double& edgeDensity) {
+	constexpr int kBlock = 8;
+	const int cols = image.width() / kBlock;
+	const int rows = image.height() / kBlock;
+	photoFraction = 0;
+	edgeDensity = 0;
+	if (cols == 0 || rows == 0)
+		return;
+
+	// A grid of at most 64x64 blocks, spread over the whole image.
+	const int stepX = qMax(1, cols / 64);
+	const int stepY = qMax(1, rows / 64);
+
+	int blocks = 0;
+	int photoBlocks = 0;
+	qint64 edges = 0;
+	qint64 pairs = 0;
+	for (int by = 0; by < rows; by += stepY) {
+		for (int bx = 0; bx < cols; bx += stepX) {
+			quint32 seen[kBlock * kBlock];
+			int distinct = 0;
+			int hard = 0;
+			for (int y = 0; y < kBlock; ++y) {
+				const quint32* px =
+					reinterpret_cast<const quint32*>(image.constScanLine(by * kBlock + y)) + bx * kBlock;
+				for (int x = 0; x < kBlock; ++x) {
+					const quint32 c = px[x] & 0xffffff;
+					if (std::find(seen, seen + distinct, c) == seen + distinct)
+						seen[distinct++] = c;
+					if (x > 0) {
+						const int l0 = qGray(px[x - 1]);
+						const int l1 = qGray(px[x]);
+						if (std::abs(l1 - l0) > 64)
+							++hard;
+					}
+				}
+			}
+
+			++blocks;
+			edges += hard;
+			pairs += kBlock * (kBlock - 1);
+			if (distinct >= 24 && hard <= kBlock)
+				++photoBlocks;
+		}
+	}
+
+	photoFraction = double(photoBlocks) / blocks;
+	edgeDensity = double(edges) / double(pairs);
+}
+
+// Mark pixels of a and b that differ by more than tol in any colour channel
+// red, and fade the rest to a light copy of a. Returns the changed count.
+static int CaptDiffRow(const quint32* a, const quint32* b, quint32* out, int n, int tol) {
+	int ix = 0;
+	int changed = 0;
+#if defined(__SSE2__)
+	const __m128i tol8 = _mm_set1_epi8(char(tol));
+	const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+	const __m128i low6 = _mm_set1_epi32(0x003f3f3f);
+	const __m128i light = _mm_set1_epi32(int(0xffc0c0c0));
+	const __m128i red = _mm_set1_epi32(int(0xffff0000));
+	const __m128i zero = _mm_setzero_si128();
+	for (; ix + 4 <= n; ix += 4) {
+		const __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + ix));
+		const __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + ix));
+		const __m128i d = _mm_or_si128(_mm_subs_epu8(pa, pb), _mm_subs_epu8(pb, pa));
+		const __m128i over = _mm_and_si128(_mm_subs_epu8(d, tol8), rgb);
+		const __m128i same = _mm_cmpeq_epi32(over, zero);
+		const __m128i faded = _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(pa, 2), low6), light);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + ix),
+		                 _mm_or_si128(_mm_and_si128(same, faded), _mm_andnot_si128(same, red)));
+		changed += 4 - qPopulationCount(quint32(_mm_movemask_ps(_mm_castsi128_ps(same))));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t tol8 = vdupq_n_u8(uint8_t(tol));
+	const uint32x4_t rgb = vdupq_n_u32(0x00ffffff);
+	const uint32x4_t low6 = vdupq_n_u32(0x003f3f3f);
+	const uint32x4_t light = vdupq_n_u32(0xffc0c0c0);
+	const uint32x4_t red = vdupq_n_u32(0xffff0000);
+	for (; ix + 4 <= n; ix += 4) {
+		const uint32x4_t pa = vld1q_u32(a + ix);
+		const uint32x4_t pb = vld1q_u32(b + ix);
+		const uint8x16_t over = vcgtq_u8(vabdq_u8(vreinterpretq_u8_u32(pa), vreinterpretq_u8_u32(pb)), tol8);
+		const uint32x4_t diff = vtstq_u32(vreinterpretq_u32_u8(over), rgb);
+		const uint32x4_t faded = vaddq_u32(vandq_u32(vshrq_n_u32(pa, 2), low6), light);
+		vst1q_u32(out + ix, vbslq_u32(diff, red, faded));
+		changed += int(vaddvq_u32(vshrq_n_u32(diff, 31)));
+	}
+#endif
+	for (; ix < n; ++ix) {
+		const quint32 pa = a[ix];
+		const quint32 pb = b[ix];
+		const bool diff = qAbs(qRed(pa) - qRed(pb)) > tol || qAbs(qGreen(pa) - qGreen(pb)) > tol ||
+		                  qAbs(qBlue(pa) - qBlue(pb)) > tol;
+		out[ix] = diff ? 0xffff0000u : ((pa >> 2) & 0x003f3f3fu) + 0xffc0c0c0u;
+		changed += diff;
+	}
+	return changed;
+}
+
+// Diff image of a against b on their common bounding size; whatever only
+// one of them covers counts as changed. Returns the changed pixel count.
+static qint64 CaptDiff(const QImage& a, const QImage& b, int tol, QImage& diff) {
+	const QSize size = a.size().expandedTo(b.size());
+	const auto canvas = [&size](const QImage& image) {
+		if (image.size() == size)
+			return image.convertToFormat(QImage::Format_RGB32);
+		QImage padded(size, QImage::Format_RGB32);
+		padded.fill(Qt::white);
+		QPainter painter(&padded);
+		painter.drawImage(0, 0, image);
+		return padded;
+	};
+
+	const QImage ca = canvas(a);
+	const QImage cb = canvas(b);
+	diff = QImage(size, QImage::Format_RGB32);
+
+	qint64 changed = 0;
+	for (int y = 0; y < size.height(); ++y) {
+		changed += CaptDiffRow(reinterpret_cast<const quint32*>(ca.constScanLine(y)),
+		                       reinterpret_cast<const quint32*>(cb.constScanLine(y)),
+		                       reinterpret_cast<quint32*>(diff.scanLine(y)), size.width(), tol);
+	}
+	return changed;
+}
+
+#if CUTYCAPT_ZLIB
+// Scanlines of an image in the smallest lossless PNG colour type.
+struct CaptPngRaw {
+	int colorType{ 0 };
+	int depth{ 8 };
+	int bpp{ 1 };
+	int rowBytes{ 0 };
+	QByteArray rows;
+	QByteArray plte;
+	QByteArray trns;
+};
+
+static void CaptPngRawIndexed(const QImage& image, CaptPngRaw& raw) {
+	const QVector<QRgb> table = image.colorTable();
+	const int n = int(table.size());
+	raw.colorType = 3;
+	raw.depth = n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+	raw.bpp = 1;
+	raw.rowBytes = (image.width() * raw.depth + 7) / 8;
+
+	bool alpha = false;
+	for (const QRgb c : table) {
+		raw.plte.append(char(qRed(c)));
+		raw.plte.append(char(qGreen(c)));
+		raw.plte.append(char(qBlue(c)));
+		raw.trns.append(char(qAlpha(c)));
+		alpha = alpha || qAlpha(c) != 255;
+	}
+	if (!alpha)
+		raw.trns.clear();
+
+	raw.rows = QByteArray(raw.rowBytes * image.height(), '\0');
+	const int perByte = 8 / raw.depth;
+	for (int y = 0; y < image.height(); ++y) {
+		const uchar* src = image.constScanLine(y);
+		uchar* dst = reinterpret_cast<uchar*>(raw.rows.data()) + qsizetype(y) * raw.rowBytes;
+		for (int x = 0; x < image.width(); ++x) {
+			const int shift = 8 - raw.depth * (x % perByte + 1);
+			dst[x / perByte] |= uchar(src[x] << shift);
+		}
+	}
+}
+
+static void CaptPngRawFor(const QImage& source, CaptPngRaw& raw) {
+	const int w = source.width();
+	const int h = source.height();
+
+	if (source.format() == QImage::Format_Indexed8) {
+		CaptPngRawIndexed(source, raw);
+		return;
+	}
+	if (source.format() == QImage::Format_Mono || source.format() == QImage::Format_MonoLSB) {
+		CaptPngRawIndexed(source.convertToFormat(QImage::Format_Indexed8), raw);
+		return;
+	}
+
+	const QImage image = source.format() == QImage::Format_Grayscale8
+	                         ? source
+	                         : source.convertToFormat(QImage::Format_ARGB32);
+
+	bool opaque = true;
+	bool gray = true;
+	if (image.format() == QImage::Format_ARGB32) {
+		for (int y = 0; y < h && (opaque || gray); ++y) {
+			const quint32* px = reinterpret_cast<const quint32*>(image.constScanLine(y));
+			for (int x = 0; x < w; ++x) {
+				opaque = opaque && qAlpha(px[x]) == 255;
+				gray = gray && qRed(px[x]) == qGreen(px[x]) && qGreen(px[x]) == qBlue(px[x]);
+			}
+		}
+
+		std::vector<QRgb> colors;
+		if (opaque && !gray && CaptExactColors(image, 256, colors)) {
+			CaptPngRawIndexed(CaptQuantize(image, 256, false), raw);
+			return;
+		}
+	}
+
+	raw.colorType = gray && opaque ? 0 : opaque ? 2 : 6;
+	raw.depth = 8;
+	raw.bpp = raw.colorType == 0 ? 1 : raw.colorType == 2 ? 3 : 4;
+	raw.rowBytes = w * raw.bpp;
+	raw.rows = QByteArray(raw.rowBytes * h, '\0');
+
+	for (int y = 0; y < h; ++y) {
+		uchar* dst = reinterpret_cast<uchar*>(raw.rows.data()) + qsizetype(y) * raw.rowBytes;
+		if (image.format() == QImage::Format_Grayscale8) {
+			memcpy(dst, image.constScanLine(y), size_t(w));
+			continue;
+		}
+		const quint32* px = reinterpret_cast<const quint32*>(image.constScanLine(y));
+		for (int x = 0; x < w; ++x) {
+			const QRgb c = px[x];
+			if (raw.colorType == 0) {
+				*dst++ = uchar(qRed(c));
+				continue;
+			}
+			*dst++ = uchar(qRed(c));
+			*dst++ = uchar(qGreen(c));
+			*dst++ = uchar(qBlue(c));
+			if (raw.colorType == 6)
+				*dst++ = uchar(qAlpha(c));
+		}
+	}
+}
+
+static inline uchar CaptPaeth(int a, int b, int c) {
+	const int p = a + b - c;
+	const int pa = std::abs(p - a);
+	const int pb = std::abs(p - b);
+	const int pc = std::abs(p - c);
+	return uchar(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+// Filter every row with the given PNG filter type, or with the per-row
+// minimum-sum-of-absolute-differences heuristic when filter is -1.
+static QByteArray CaptPngFilter(const CaptPngRaw& raw, int filter) {
+	const int h = raw.rowBytes > 0 ? int(raw.rows.size() / raw.rowBytes) : 0;
+	const int n = raw.rowBytes;
+	const int bpp = raw.bpp;
+	QByteArray out(qsizetype(h) * (n + 1), '\0');
+	std::vector<uchar> zero(size_t(n), 0);
+	std::vector<uchar> candidate[5];
+	for (auto& c : candidate)
+		c.resize(size_t(n));
+
+	for (int y = 0; y < h; ++y) {
+		const uchar* cur = reinterpret_cast<const uchar*>(raw.rows.constData()) + qsizetype(y) * n;
+		const uchar* up = y > 0 ? cur - n : zero.data();
+		uchar* dst = reinterpret_cast<uchar*>(out.data()) + qsizetype(y) * (n + 1);
+
+		const int first = filter < 0 ? 0 : filter;
+		const int last = filter < 0 ? 4 : filter;
+		int best = first;
+		quint64 bestCost = ~quint64(0);
+		for (int f = first; f <= last; ++f) {
+			uchar* row = candidate[f].data();
+			quint64 cost = 0;
+			for (int x = 0; x < n; ++x) {
+				const int a = x >= bpp ? cur[x - bpp] : 0;
+				const int b = up[x];
+				const int c = x >= bpp ? up[x - bpp] : 0;
+				int pred = 0;
+				switch (f) {
+					case 1: pred = a; break;
+					case 2: pred = b; break;
+					case 3: pred = (a + b) / 2; break;
+					case 4: pred = CaptPaeth(a, b, c); break;
+					default: break;
+				}
+				row[x] = uchar(cur[x] - pred);
+				cost += quint64(std::abs(int(qint8(row[x]))));
+			}
+			if (cost < bestCost) {
+				bestCost = cost;
+				best = f;
+			}
+		}
+
+		dst[0] = char(best);
+		memcpy(dst + 1, candidate[best].data(), size_t(n));
+	}
+	return out;
+}
+
+// windowBits 15 + 16 writes a gzip member instead of a zlib stream.
+static QByteArray CaptDeflate(const QByteArray& data, int strategy, int windowBits = 15) {
+	z_stream zs{};
+	if (deflateInit2(&zs, 9, Z_DEFLATED, windowBits, 9, strategy) != Z_OK)
+		return QByteArray();
+
+	QByteArray out(qsizetype(deflateBound(&zs, uLong(data.size()))), '\0');
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+	zs.avail_in = uInt(data.size());
+	zs.next_out = reinterpret_cast<Bytef*>(out.data());
+	zs.avail_out = uInt(out.size());
+	const int rc = deflate(&zs, Z_FINISH);
+	out.resize(qsizetype(zs.total_out));
+	deflateEnd(&zs);
+	return rc == Z_STREAM_END ? out : QByteArray();
+}
+
+static void CaptPngChunk(QByteArray& png, const char* type, const QByteArray& data) {
+	const quint32 len = quint32(data.size());
+	png.append(char(len >> 24));
+	png.append(char(len >> 16));
+	png.append(char(len >> 8));
+	png.append(char(len));
+	const qsizetype start = png.size();
+	png.append(type, 4);
+	png.append(data);
+	const quint32 crc = quint32(crc32(crc32(0, nullptr, 0),
+	                                  reinterpret_cast<const Bytef*>(png.constData() + start),
+	                                  uInt(png.size() - start)));
+	png.append(char(crc >> 24));
+	png.append(char(crc >> 16));
+	png.append(char(crc >> 8));
+	png.append(char(crc));
+}
+
+// Exhaustive lossless PNG encoding: colour type and bit depth reduction,
+// then every filter choice against two zlib strategies at level 9.
+static QByteArray CaptEncodePngSmallest(const QImage& image) {
+	CaptPngRaw raw;
+	CaptPngRawFor(image, raw);
+
+	QByteArray best;
+	for (int filter = -1; filter <= 4; ++filter) {
+		// Palette and sub-byte images rarely gain from prediction.
+		if (raw.colorType == 3 && filter > 0 && raw.depth < 8)
+			continue;
+		const QByteArray filtered = CaptPngFilter(raw, filter);
+		for (const int strategy : { Z_DEFAULT_STRATEGY, Z_FILTERED }) {
+			const QByteArray idat = CaptDeflate(filtered, strategy);
+			if (!idat.isEmpty() && (best.isEmpty() || idat.size() < best.size()))
+				best = idat;
+		}
+	}
+	if (best.isEmpty())
+		return QByteArray();
+
+	QByteArray ihdr;
+	for (const quint32 v : { quint32(image.width()), quint32(image.height()) }) {
+		ihdr.append(char(v >> 24));
+		ihdr.append(char(v >> 16));
+		ihdr.append(char(v >> 8));
+		ihdr.append(char(v));
+	}
+	ihdr.append(char(raw.depth));
+	ihdr.append(char(raw.colorType));
+	ihdr.append(char(0));
+	ihdr.append(char(0));
+	ihdr.append(char(0));
+
+	QByteArray png("\x89PNG\r\n\x1a\n", 8);
+	CaptPngChunk(png, "IHDR", ihdr);
+	if (!raw.plte.isEmpty())
+		CaptPngChunk(png, "PLTE", raw.plte);
+	if (!raw.trns.isEmpty())
+		CaptPngChunk(png, "tRNS", raw.trns);
+	for (const QString& key : image.textKeys()) {
+		CaptPngChunk(png, "tEXt", key.toLatin1() + '\0' + image.text(key).toLatin1());
+	}
+	CaptPngChunk(png, "IDAT", best);
+	CaptPngChunk(png, "IEND", QByteArray());
+	return png;
+}
+
+// Entry point of the detached --recompress-png worker: rewrite a finished
+// PNG with CaptEncodePngSmallest() at idle priority and swap it in only if
+// it got smaller and nobody touched the file meanwhile.
+static int CaptRecompressPng(const QString& path, bool silent) {
+#if defined(Q_OS_LINUX)
+	const sched_param param{};
+	sched_setscheduler(0, SCHED_IDLE, &param);
+#endif
+#if defined(Q_OS_UNIX)
+	setpriority(PRIO_PROCESS, 0, 19);
+#endif
+
+	// QFileInfo reads lazily; take the stamp before the slow encode.
+	const QFileInfo before(path);
+	const qint64 size = before.size();
+	const QDateTime modified = before.lastModified();
+	const QImage image(path, "png");
+	if (image.isNull()) {
+		if (!silent)
+			std::cerr << "Unable to read '" << path.toStdString() << "' for recompression" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const QByteArray png = CaptEncodePngSmallest(image);
+	if (png.isEmpty() || png.size() >= size)
+		return EXIT_SUCCESS;
+
+	const QFileInfo after(path);
+	if (after.size() != size || after.lastModified() != modified)
+		return EXIT_SUCCESS;
+
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly) || file.write(png) != png.size() || !file.commit()) {
+		if (!silent)
+			std::cerr << "Unable to replace '" << path.toStdString() << "'" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (!silent) {
+		std::clog << "Recompressed '" << path.toStdString() << "' from " << size << " to "
+		          << png.size() << " bytes" << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
+#endif
+
+#if CUTYCAPT_LIBJPEG
+struct CaptJpegError {
+	jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+static void CaptJpegErrorExit(j_common_ptr cinfo) {
+	longjmp(reinterpret_cast<CaptJpegError*>(cinfo->err)->jump, 1);
+}
+
+// libjpeg reports errors with longjmp, so this frame holds plain data only.
+// Rows are handed to the encoder as they are laid out in the QImage; with
+// libjpeg-turbo that includes 32-bit pixels, which its SIMD colour
+// converter turns into YCbCr without an intermediate RGB copy.
+static bool CaptEncodeJpeg(const QImage& image, int quality, int subsampling, bool progressive,
+                           bool optimize, unsigned char** data, unsigned long* size) {
+	jpeg_compress_struct cinfo;
+	CaptJpegError err;
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = CaptJpegErrorExit;
+	if (setjmp(err.jump)) {
+		jpeg_destroy_compress(&cinfo);
+		return false;
+	}
+
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, data, size);
+
+	cinfo.image_width = JDIMENSION(image.width());
+	cinfo.image_height = JDIMENSION(image.height());
+	if (image.format() == QImage::Format_Grayscale8) {
+		cinfo.input_components = 1;
+		cinfo.in_color_space = JCS_GRAYSCALE;
+	} else if (image.format() == QImage::Format_RGB888) {
+		cinfo.input_components = 3;
+		cinfo.in_color_space = JCS_RGB;
+#ifdef JCS_EXTENSIONS
+	} else if (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32 ||
+	           image.format() == QImage::Format_ARGB32_Premultiplied) {
+		// 0xAARRGGBB words; other 32-bit layouts (RGBA8888...) differ.
+		cinfo.input_components = 4;
+		cinfo.in_color_space = Q_BYTE_ORDER == Q_LITTLE_ENDIAN ? JCS_EXT_BGRX : JCS_EXT_XRGB;
+#endif
+	} else {
+		jpeg_destroy_compress(&cinfo);
+		return false;
+	}
+
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	if (cinfo.input_components > 1) {
+		cinfo.comp_info[0].h_samp_factor = subsampling == 444 ? 1 : 2;
+		cinfo.comp_info[0].v_samp_factor = subsampling == 420 ? 2 : 1;
+	}
+	cinfo.optimize_coding = optimize ? TRUE : FALSE;
+	if (progressive)
+		jpeg_simple_progression(&cinfo);
+
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		JSAMPROW row = const_cast<JSAMPROW>(image.constScanLine(int(cinfo.next_scanline)));
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return true;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////
+// CutyEnginePage (Qt6-correct overrides live here)
+////////////////////////////////////////////////////////////////////
+
+CutyEnginePage::CutyEnginePage(QObject* parent) : QWebEnginePage(parent) {}
+
+void CutyEnginePage::handleCertificateError(QWebEngineCertificateError error) {
+	// If user didn't request insecure mode, do nothing (default rejection).
+	if (!mInsecure)
+		return;
+
+	// Accept only overridable errors.
+	if (error.isOverridable())
+		error.acceptCertificate();
+}
+
+void CutyEnginePage::setUserAgent(const QString& userAgent) {
+	mUserAgent = userAgent;
+	profile()->setHttpUserAgent(userAgent);
+}
+
+void CutyEnginePage::setAlertString(const QString& alertString) {
+	mAlertString = alertString;
+}
+
+QString CutyEnginePage::getAlertString() const {
+	return mAlertString;
+}
+
+void CutyEnginePage::setPrintAlerts(bool printAlerts) {
+	mPrintAlerts = printAlerts;
+}
+
+void CutyEnginePage::setCutyCapt(CutyCapt* cutyCapt) {
+	mCutyCapt = cutyCapt;
+}
+
+void CutyEnginePage::setLifecyclePrefix(const QString& prefix) {
+	mLifecyclePrefix = prefix;
+}
+
+void CutyEnginePage::setInsecure(bool insecure) {
+	mInsecure = insecure;
+}
+
+QStringList CutyEnginePage::chooseFiles(FileSelectionMode /*mode*/, const QStringList& /*oldFiles*/,
+                                       const QStringList& /*acceptedMimeTypes*/) {
+	// Headless CLI tool: never open a file dialog.
+	return {};
+}
+
+void CutyEnginePage::javaScriptAlert(const QUrl& /*securityOrigin*/, const QString& msg) {
+	if (mPrintAlerts) {
+		qDebug() << "[alert]" << msg;
+	}
+
+	// Preserve the "expect-alert triggers capture" behavior.
+	if (!mAlertString.isEmpty() && msg == mAlertString && mCutyCapt) {
+		QTimer::singleShot(10, mCutyCapt, SLOT(Delayed()));
+	}
+}
+
+bool CutyEnginePage::javaScriptConfirm(const QUrl& /*securityOrigin*/, const QString& /*msg*/) {
+	return true;
+}
+
+bool CutyEnginePage::javaScriptPrompt(const QUrl& /*securityOrigin*/, const QString& /*msg*/,
+                                     const QString& /*defaultValue*/, QString* result) {
+	if (result) *result = QString();
+	return true;
+}
+
+void CutyEnginePage::javaScriptConsoleMessage(JavaScriptConsoleMessageLevel level,
+                                              const QString& message, int lineNumber,
+                                              const QString& sourceID) {
+	if (mLifecyclePrefix.isEmpty() || !message.startsWith(mLifecyclePrefix)) {
+		QWebEnginePage::javaScriptConsoleMessage(level, message, lineNumber, sourceID);
+		return;
+	}
+
+	if (mCutyCapt)
+		mCutyCapt->LifecycleEvent(message.mid(mLifecyclePrefix.size()));
+}
+
+////////////////////////////////////////////////////////////////////
+// CutyPage
+////////////////////////////////////////////////////////////////////
+
+CutyPage::CutyPage(QWidget* parent) : QWebEngineView(parent) {
+	mEnginePage = new CutyEnginePage(this);
+	setPage(mEnginePage);
+
+	// Qt6: TLS errors are delivered via signal; connect and optionally accept.
+	QObject::connect(mEnginePage, &QWebEnginePage::certificateError,
+	                 this, [this](QWebEngineCertificateError error) {
+		                 mEnginePage->handleCertificateError(error);
+	                 });
+
+	// Report page lifecycle milestones through console.debug, which
+	// CutyEnginePage::javaScriptConsoleMessage() picks up. The observer runs
+	// in its own world and tags its messages with a per-run token, so page
+	// scripts can neither shadow it nor fake an event.
+	const QString prefix = QStringLiteral("cutycapt:%1:")
+	                           .arg(QUuid::createUuid().toString(QUuid::WithoutBraces));
+	mEnginePage->setLifecyclePrefix(prefix);
+
+	QWebEngineScript lifecycle;
+	lifecycle.setName(QStringLiteral("cutycapt-lifecycle-observer"));
+	lifecycle.setInjectionPoint(QWebEngineScript::DocumentCreation);
+	lifecycle.setRunsOnSubFrames(false);
+	lifecycle.setWorldId(QWebEngineScript::ApplicationWorld);
+	lifecycle.setSourceCode(QStringLiteral(R"(
+		(function() {
+			const log = console.debug.bind(console);
+			const report = function(name) { log('%1' + name); };
+
+			// Document creation means the response has started arriving.
+			report('commit');
+
+			document.addEventListener('DOMContentLoaded', function() {
+				report('domcontentloaded');
+			}, { once: true });
+
+			try {
+				new PerformanceObserver(function(list) {
+					for (const entry of list.getEntries()) {
+						if (entry.name === 'first-contentful-paint')
+							report('fcp');
+					}
+				}).observe({ type: 'paint', buffered: true });
+			} catch (e) {}
+
+			// LCP candidates keep coming while the page renders; call it
+			// settled after half a second without a new one.
+			let lcpTimer = 0;
+			try {
+				new PerformanceObserver(function() {
+					clearTimeout(lcpTimer);
+					lcpTimer = setTimeout(function() { report('lcp'); }, 500);
+				}).observe({ type: 'largest-contentful-paint', buffered: true });
+			} catch (e) {}
+		})();
+	)").arg(prefix));
+	mEnginePage->scripts().insert(lifecycle);
+}
+
+void CutyPage::setAttribute(QWebEngineSettings::WebAttribute option, const QString& value) {
+	const bool on = (value == "on");
+	const bool off = (value == "off");
+	if (on || off)
+		settings()->setAttribute(option, on);
+}
+
+void CutyPage::setAttribute(Qt::WidgetAttribute option, bool value) {
+	QWidget::setAttribute(option, value);
+}
+
+void CutyPage::setUserAgent(const QString& userAgent) {
+	mEnginePage->setUserAgent(userAgent);
+}
+
+void CutyPage::setAlertString(const QString& alertString) {
+	mEnginePage->setAlertString(alertString);
+}
+
+QString CutyPage::getAlertString() const {
+	return mEnginePage->getAlertString();
+}
+
+void CutyPage::setPrintAlerts(bool printAlerts) {
+	mEnginePage->setPrintAlerts(printAlerts);
+}
+
+void CutyPage::setCutyCapt(CutyCapt* cutyCapt) {
+	mEnginePage->setCutyCapt(cutyCapt);
+}
+
+void CutyPage::setInsecure(bool insecure) {
+	mEnginePage->setInsecure(insecure);
+}
+
+void CutyPage::copySettings(const CutyPage& other) {
+	static const QWebEngineSettings::WebAttribute attributes[] = {
+		QWebEngineSettings::AutoLoadImages,
+		QWebEngineSettings::JavascriptEnabled,
+		QWebEngineSettings::PluginsEnabled,
+		QWebEngineSettings::JavascriptCanOpenWindows,
+		QWebEngineSettings::JavascriptCanAccessClipboard,
+		QWebEngineSettings::PrintElementBackgrounds,
+		QWebEngineSettings::ShowScrollBars,
+	};
+	for (QWebEngineSettings::WebAttribute attribute : attributes)
+		settings()->setAttribute(attribute, other.settings()->testAttribute(attribute));
+
+	// The user agent lives on the shared default profile already.
+	setZoomFactor(other.zoomFactor());
+	mEnginePage->setAlertString(other.getAlertString());
+}
+
+#if CUTYCAPT_SCRIPT
+// Install a WebChannel bridge object into the JS environment as window[scriptObjectName]
+// and inject user script source at DocumentReady.
+void CutyPage::installScriptSupport(const QString& scriptObjectName,
+                                    const QString& injectedUserScriptSource,
+                                    bool silent) {
+	if (!mChannel) {
+		mChannel = new QWebChannel(this);
+		mBridge = new CutyScriptBridge(this);
+
+		// Register the object under a stable internal name.
+		// We then alias it to window[scriptObjectName] in JS.
+		mChannel->registerObject(QStringLiteral("cuty"), mBridge);
+		page()->setWebChannel(mChannel);
+
+		// Optional: let scripts print to stderr via cuty.jsLog("...")
+		QObject::connect(mBridge, &CutyScriptBridge::log, this, [silent](const QString& msg) {
+			if (!silent)
+				std::clog << "[script] " << msg.toStdString() << std::endl;
+		});
+	}
+
+	const QString objName = scriptObjectName.isEmpty() ? QStringLiteral("cuty") : scriptObjectName;
+
+	// 1) Bootstrap: load qwebchannel.js and expose bridge as window[objName]
+	const QString bootstrap = QStringLiteral(R"(
+		(function() {
+			function boot() {
+				if (typeof QWebChannel === 'undefined') {
+					// qwebchannel.js not loaded yet
+					return false;
+				}
+				new QWebChannel(qt.webChannelTransport, function(channel) {
+					window.%1 = channel.objects.cuty;
+				});
+				return true;
+			}
+
+			// If already loaded, just boot
+			if (typeof qt !== 'undefined' && qt.webChannelTransport) {
+				if (boot()) return;
+			}
+
+			// Load qwebchannel.js from Qt resource
+			var s = document.createElement('script');
+			s.src = 'qrc:///qtwebchannel/qwebchannel.js';
+			s.onload = function() { boot(); };
+			(document.head || document.documentElement).appendChild(s);
+		})();
+	)").arg(objName);
+
+	QWebEngineScript bootScript;
+	bootScript.setName(QStringLiteral("cutycapt-webchannel-bootstrap"));
+	bootScript.setInjectionPoint(QWebEngineScript::DocumentReady);
+	bootScript.setRunsOnSubFrames(true);
+	bootScript.setWorldId(QWebEngineScript::MainWorld);
+	bootScript.setSourceCode(bootstrap);
+	page()->scripts().insert(bootScript);
+
+	// 2) Inject user script (if provided)
+	if (!injectedUserScriptSource.trimmed().isEmpty()) {
+		QWebEngineScript userScript;
+		userScript.setName(QStringLiteral("cutycapt-user-injected-script"));
+		userScript.setInjectionPoint(QWebEngineScript::DocumentReady);
+		userScript.setRunsOnSubFrames(true);
+		userScript.setWorldId(QWebEngineScript::MainWorld);
+		userScript.setSourceCode(injectedUserScriptSource);
+		page()->scripts().insert(userScript);
+	}
+}
+#endif
+
+////////////////////////////////////////////////////////////////////
+// CutyCapt
+////////////////////////////////////////////////////////////////////
+
+CutyCapt::CutyCapt(CutyPage* page, const QString& output, int delay, OutputFormat format,
+                   const QString& scriptProp, const QString& scriptCode, bool insecure, bool smooth,
+                   bool silent)
+	: mOutput(output),
+	  mDelay(delay),
+	  mPage(page),
+	  mFormat(format),
+	  mScriptObj(new QObject()),
+	  mScriptProp(scriptProp),
+	  mScriptCode(scriptCode),
+	  mInsecure(insecure),
+	  mSmooth(smooth),
+	  mSilent(silent) {
+	mPage->setCutyCapt(this);
+	mPage->setInsecure(insecure);
+
+	mPhaseTimer.setSingleShot(true);
+	QObject::connect(&mPhaseTimer, &QTimer::timeout, this, &CutyCapt::PhaseTimeout);
+
+	mCpuTimer.setInterval(200);
+	QObject::connect(&mCpuTimer, &QTimer::timeout, this, &CutyCapt::checkCpu);
+
+	// Grace for the capture once the renderer is over its CPU budget.
+	mDeadlineTimer.setInterval(5000);
+	mDeadlineTimer.setSingleShot(true);
+	QObject::connect(&mDeadlineTimer, &QTimer::timeout, this, &CutyCapt::captureDeadline);
+
+#if CUTYCAPT_SCRIPT
+	wireScriptSignals();
+#endif
 }
 
 #if CUTYCAPT_SCRIPT
@@ -270,193 +1869,2393 @@ void CutyCapt::wireScriptSignals() {
 }
 #endif
 
-void CutyCapt::DocumentComplete(bool ok) {
-	if (!mSilent && !ok) {
-		std::cerr << "WebEngine failed to completely load url" << std::endl;
-		QApplication::exit(1);
+void CutyCapt::DocumentComplete(bool ok) {
+	// Finishes pair with starts in order; this one is for a load a retry
+	// replaced.
+	if (++mLoadsFinished < mAttemptLoad)
+		return;
+
+	if (mSawDocumentComplete) {
+		// Already capturing on an earlier --wait-until event.
+		markMetric("load.finished_ms");
+		return;
+	}
+
+	if (!mSilent && !ok) {
+		std::cerr << "WebEngine failed to completely load url" << std::endl;
+		done(1);
+		return;
+	} else if (!mSilent) {
+		std::cerr << "WebEngine finished loadFinished(true)" << std::endl;
+	}
+
+	mSawDocumentComplete = true;
+	markMetric("load.finished_ms");
+	enterPhase(ReadyPhase);
+
+	// Make viewport sizing more reliable in Qt6: ask DOM for scroll size.
+	updateViewportToContentThenMaybeCapture();
+}
+
+void CutyCapt::setFullPage(bool fullPage) {
+	mFullPage = fullPage;
+}
+
+void CutyCapt::setMaxHeight(int maxHeight) {
+	mMaxHeight = maxHeight;
+}
+
+void CutyCapt::setSizingPasses(int passes) {
+	mSizingPasses = passes > 0 ? passes : 1;
+}
+
+void CutyCapt::setAutotrim(int tolerance) {
+	mAutotrim = qMin(tolerance, 255);
+}
+
+void CutyCapt::setColorMode(ColorMode mode, int threshold) {
+	mColorMode = mode;
+	mThreshold = threshold;
+}
+
+void CutyCapt::setJpegOptions(int quality, int subsampling, bool progressive, bool optimize) {
+	mJpegQuality = qBound(0, quality, 100);
+	mJpegSubsampling = subsampling;
+	mJpegProgressive = progressive;
+	mJpegOptimize = optimize;
+}
+
+void CutyCapt::setRecompress(bool recompress) {
+	mRecompress = recompress;
+}
+
+void CutyCapt::setPerceptualHash(bool sidecar, const QString& index, int distance,
+                                 bool skipDuplicates) {
+	mPhashSidecar = sidecar;
+	mPhashIndex = index;
+	mPhashDistance = distance;
+	mSkipDuplicates = skipDuplicates;
+}
+
+void CutyCapt::setPhaseTimeout(Phase phase, int ms, PhasePolicy policy) {
+	mPhaseBudget[phase] = qMax(0, ms);
+	mPhasePolicy[phase] = policy;
+}
+
+void CutyCapt::setRetries(int retries, const QWebEngineHttpRequest& request) {
+	mRetries = qMax(0, retries);
+	mRequest = request;
+}
+
+void CutyCapt::setCpuBudget(int ms, PhasePolicy policy) {
+	mCpuBudget = qMax(0, ms);
+	mCpuPolicy = policy;
+#if defined(Q_OS_LINUX)
+	if (mCpuBudget > 0)
+		mCpuTimer.start();
+#else
+	if (mCpuBudget > 0 && !mSilent)
+		std::cerr << "--max-cpu-ms is only supported on Linux" << std::endl;
+#endif
+}
+
+void CutyCapt::setDevTools(CutyDevTools* devTools, double scale) {
+	mDevTools = devTools;
+	mScale = scale > 0 ? scale : 1.0;
+}
+
+void CutyCapt::setWarc(CutyWarc* warc) {
+	mWarc = warc;
+}
+
+void CutyCapt::setTrace(CutyTrace* trace) {
+	mTrace = trace;
+}
+
+void CutyCapt::setWaitUntil(const QString& event) {
+	mWaitUntil = event;
+}
+
+void CutyCapt::setPreview(const QString& path, int width) {
+	mPreview = path;
+	mPreviewWidth = width > 0 ? width : 480;
+}
+
+void CutyCapt::setContactSheet(const QString& path, int columns, int rows, int thumbWidth) {
+	mContactSheet = path;
+	mContactColumns = columns > 0 ? columns : 6;
+	mContactRows = rows > 0 ? rows : 8;
+	mContactThumb = thumbWidth > 0 ? thumbWidth : 240;
+}
+
+void CutyCapt::setFrames(const QString& selector, const QString& content) {
+	mFrames = selector;
+	mFrameContent = content;
+}
+
+void CutyCapt::addClip(const QRect& rect) {
+	mClips.append(rect);
+}
+
+void CutyCapt::addClipSelector(const QString& selector) {
+	mClipSelectors.append(selector);
+}
+
+void CutyCapt::setRenderProfile(RenderProfile profile) {
+	mRenderProfile = profile;
+	if (profile == CompactRender) {
+		mPage->page()->setBackgroundColor(Qt::white);
+		mDither = false;
+	}
+}
+
+void CutyCapt::setSvgTiles(const QString& format, int size, bool text) {
+	mSvgTiles = format;
+	mSvgTileSize = size > 0 ? size : 512;
+	mSvgText = text;
+}
+
+void CutyCapt::setMetricsPrefix(const QString& prefix) {
+	mMetricsPrefix = prefix;
+}
+
+void CutyCapt::metric(const QString& key, const QJsonValue& value) {
+	CutyMetrics::set(mMetricsPrefix + key, value);
+}
+
+void CutyCapt::markMetric(const QString& key) {
+	CutyMetrics::mark(mMetricsPrefix + key);
+}
+
+void CutyCapt::setQuantize(int colors, bool dither) {
+	mQuantize = colors > 0 ? qBound(2, colors, 256) : 0;
+	mDither = dither;
+}
+
+QSize CutyCapt::clampedSize(const QSize& size) const {
+	if (mMaxHeight > 0 && size.height() > mMaxHeight)
+		return QSize(size.width(), mMaxHeight);
+	return size;
+}
+
+void CutyCapt::updateViewportToContentThenMaybeCapture() {
+	// No paint timing reported (or it came too late): preview before the
+	// widget grows, whichever event started the capture.
+	savePreview();
+
+	// If the caller expects an alert trigger, we keep waiting.
+	if (!mPage->getAlertString().isEmpty())
+		return;
+
+	// Viewport-only captures skip measuring so no full-height layout or
+	// compositor surface is ever created.
+	if (!mFullPage) {
+		mViewSize = mPage->size();
+		mSawGeometryChange = !mViewSize.isEmpty();
+		if (mSawDocumentComplete && mSawGeometryChange)
+			TryDelayedRender();
+		return;
+	}
+
+	mSizingPass = 0;
+	measureContentSize();
+}
+
+// Pages with vh-based layouts, responsive grids or feeds change height once
+// the widget grows, so keep resizing until the measurement stops moving.
+void CutyCapt::measureContentSize() {
+	const QString js = R"(
+		(function() {
+			const de = document.documentElement;
+			const body = document.body;
+			const w = Math.max(de ? de.scrollWidth : 0, body ? body.scrollWidth : 0, window.innerWidth || 0);
+			const h = Math.max(de ? de.scrollHeight : 0, body ? body.scrollHeight : 0, window.innerHeight || 0);
+			return { width: w, height: h };
+		})()
+	)";
+
+	const int attempt = mAttempt;
+	mPage->page()->runJavaScript(js, QWebEngineScript::ApplicationWorld, [this, attempt](const QVariant& v) {
+		// Left over from an attempt a retry replaced, or the capture
+		// already started without waiting for sizing.
+		if (attempt != mAttempt || mCaptureStarted)
+			return;
+
+		const auto m = v.toMap();
+		const int w = m.value("width").toInt();
+		const int h = m.value("height").toInt();
+
+		++mSizingPass;
+
+		if (w > 0 && h > 0) {
+			const QSize content = clampedSize(QSize(w, h));
+			// The DevTools backend shoots beyond the viewport, no resizing.
+			const bool converged = mDevTools || content == mPage->size();
+
+			if (!mSilent) {
+				std::clog << "Sizing pass " << mSizingPass << ": content " << w << "x" << h
+				          << (converged ? " (stable)" : "") << std::endl;
+			}
+
+			mViewSize = content;
+			mSawGeometryChange = true;
+
+			if (!converged) {
+				mPage->setMinimumSize(mViewSize);
+				mPage->resize(mViewSize);
+
+				// Give Chromium a moment to relayout at the new size.
+				if (mSizingPass < mSizingPasses) {
+					QTimer::singleShot(100, this, [this, attempt] {
+						if (attempt == mAttempt)
+							measureContentSize();
+					});
+					return;
+				}
+
+				if (!mSilent && mSizingPasses > 1) {
+					std::clog << "Content size did not converge after " << mSizingPass << " passes"
+					          << std::endl;
+				}
+			}
+		} else {
+			// Fall back to current widget size if DOM size is not available yet.
+			mViewSize = mPage->size();
+			mSawGeometryChange = !mViewSize.isEmpty();
+		}
+
+		metric("sizing.passes", mSizingPass);
+
+		if (mSawDocumentComplete && mSawGeometryChange)
+			TryDelayedRender();
+	});
+}
+
+void CutyCapt::TryDelayedRender() {
+	if (!mPage->getAlertString().isEmpty())
+		return;
+
+	if (mDelay > 0) {
+		const int attempt = mAttempt;
+		QTimer::singleShot(mDelay, this, [this, attempt] {
+			if (attempt == mAttempt)
+				saveSnapshot();
+		});
+		return;
+	}
+
+	saveSnapshot();
+}
+
+void CutyCapt::Timeout() {
+	if (!mSilent)
+		std::clog << "Timeout reached" << std::endl;
+
+	saveSnapshot();
+}
+
+void CutyCapt::Delayed() {
+	saveSnapshot();
+}
+
+void CutyCapt::LoadStarted() {
+	++mLoadsStarted;
+	if (mSawDocumentComplete)
+		return;
+	markMetric("load.started_ms");
+	enterPhase(FirstBytePhase);
+}
+
+void CutyCapt::enterPhase(Phase phase) {
+	mPhase = phase;
+	mPhaseTimer.stop();
+	if (mPhaseBudget[phase] > 0)
+		mPhaseTimer.start(mPhaseBudget[phase]);
+}
+
+// Sum the CPU time of every renderer process the page has used (navigations
+// may swap processes) and contain the page once it exceeds the budget.
+void CutyCapt::checkCpu() {
+#if defined(Q_OS_LINUX)
+	const qint64 pid = mPage->page()->renderProcessPid();
+	if (pid <= 0 || mCpuExceeded)
+		return;
+
+	QFile stat(QStringLiteral("/proc/%1/stat").arg(pid));
+	if (!stat.open(QIODevice::ReadOnly))
+		return;
+
+	// Fields after the parenthesised command: state is field 3, utime and
+	// stime are fields 14 and 15, in clock ticks.
+	const QByteArray line = stat.readAll();
+	const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+	if (fields.size() < 13)
+		return;
+	const qint64 ticks = fields[11].toLongLong() + fields[12].toLongLong();
+	mCpuByPid.insert(pid, ticks * 1000 / sysconf(_SC_CLK_TCK));
+
+	qint64 used = 0;
+	for (qint64 ms : std::as_const(mCpuByPid))
+		used += ms;
+	metric("cpu.renderer_ms", double(used));
+
+	if (used <= mCpuBudget)
+		return;
+
+	mCpuExceeded = true;
+	metric("cpu.exceeded", true);
+	if (!mSilent)
+		std::clog << "Renderer used " << used << " ms of CPU, over the budget" << std::endl;
+
+	// Keep it from slowing down other captures while we finish.
+	setpriority(PRIO_PROCESS, id_t(pid), 19);
+	mPage->settings()->setAttribute(QWebEngineSettings::JavascriptEnabled, false);
+	mPage->stop();
+
+	if (mCpuPolicy == FailPolicy) {
+		kill(pid_t(pid), SIGKILL);
+		done(CpuExitCode);
+		return;
+	}
+
+	// Neither of those interrupts a script that is already running, and
+	// every output but a grab of the widget waits on the renderer. DevTools
+	// can end the script and keep new ones from starting; without it the
+	// renderer is frozen and only its last frame is written. Either way the
+	// capture has until the deadline to finish.
+	if (mDevTools && mDevTools->isOpen()) {
+		mDevTools->send(QStringLiteral("Emulation.setScriptExecutionDisabled"),
+		                QJsonObject{ { "value", true } });
+		mDevTools->send(QStringLiteral("Runtime.terminateExecution"));
+	} else {
+		kill(pid_t(pid), SIGSTOP);
+		mFrozenPid = pid;
+	}
+	mDeadlineTimer.start();
+
+	if (mCaptureStarted) {
+		if (mFrozenPid > 0)
+			saveFrozenFrame(mOutput);
+		return;
+	}
+	mSawDocumentComplete = true;
+	saveSnapshot();
+#endif
+}
+
+// The capture is still waiting on a renderer that was over its budget:
+// freeze it for good and write what it last showed.
+void CutyCapt::captureDeadline() {
+	metric("cpu.deadline", true);
+	if (!mSilent)
+		std::clog << "Capture still waiting on the renderer, writing its last frame" << std::endl;
+#if defined(Q_OS_LINUX)
+	const qint64 pid = mFrozenPid > 0 ? mFrozenPid : mPage->page()->renderProcessPid();
+	if (pid > 0) {
+		kill(pid_t(pid), SIGSTOP);
+		mFrozenPid = pid;
+	}
+#endif
+	saveFrozenFrame(mOutput);
+}
+
+void CutyCapt::saveFrozenFrame(const QString& out) {
+	if (mFormat < PngFormat) {
+		if (!mSilent)
+			std::cerr << "Renderer stopped over its CPU budget, nothing to write to '"
+			          << out.toStdString() << "'" << std::endl;
+		done(CpuExitCode);
+		return;
+	}
+
+	const char* format = nullptr;
+	for (int ix = 0; CutyExtMap[ix].id != OtherFormat; ++ix) {
+		if (CutyExtMap[ix].id == mFormat) {
+			format = CutyExtMap[ix].identifier;
+			break;
+		}
+	}
+
+	if (!mSilent && (!mClips.isEmpty() || !mClipSelectors.isEmpty() || !mFrames.isEmpty()))
+		std::clog << "Renderer stopped, writing the whole frame instead of clips and frames"
+		          << std::endl;
+	emit captured(saveRaster(grabImage(), out, format));
+	done(0);
+}
+
+void CutyCapt::PhaseTimeout() {
+	static const char* const names[PhaseCount] = { "ttfb", "dcl", "load", "ready" };
+	metric("timeout.phase", names[mPhase]);
+	if (!mSilent)
+		std::clog << "Timeout in phase " << names[mPhase] << std::endl;
+
+	switch (mPhasePolicy[mPhase]) {
+		case RetryPolicy: {
+			if (mAttempt >= mRetries || mRequest.url().isEmpty())
+				break;
+			++mAttempt;
+			metric("retry.attempts", mAttempt);
+			mAttemptLoad = mLoadsStarted + 1;
+			mSawDocumentComplete = false;
+			mSawGeometryChange = false;
+			mPage->load(mRequest);
+			return;
+		}
+		case CapturePolicy: {
+			if (mPhase == ReadyPhase) {
+				saveSnapshot();
+				return;
+			}
+			// Take whatever has rendered so far; a late loadFinished is ignored.
+			mSawDocumentComplete = true;
+			enterPhase(ReadyPhase);
+			updateViewportToContentThenMaybeCapture();
+			return;
+		}
+		case FailPolicy:
+			break;
+	}
+
+	mTimeoutTimer.stop();
+	done(PhaseExitCode + mPhase);
+}
+
+void CutyCapt::onContentsSizeChanged(const QSizeF& size) {
+	// Still useful as an extra hint; but JS sizing is the primary approach now.
+	if (!mSilent) {
+		std::clog << "contentsSizeChanged (" << size.width() << ", " << size.height() << ")"
+		          << std::endl;
+	}
+	if (mFullPage && size.width() > 0 && size.height() > 0) {
+		mViewSize = clampedSize(size.toSize());
+		mSawGeometryChange = true;
+	}
+}
+
+void CutyCapt::LifecycleEvent(const QString& name) {
+	markMetric(QStringLiteral("lifecycle.") + name + QStringLiteral("_ms"));
+	if (!mSilent)
+		std::clog << "Lifecycle event: " << name.toStdString() << std::endl;
+
+	if (name == QLatin1String("commit") && mPhase == FirstBytePhase)
+		enterPhase(DomContentPhase);
+	else if (name == QLatin1String("domcontentloaded") && mPhase < LoadPhase)
+		enterPhase(LoadPhase);
+
+	if (name == QLatin1String("fcp"))
+		savePreview();
+
+	// Early trigger: proceed as if the load had finished; the real
+	// loadFinished is then ignored.
+	if (!mWaitUntil.isEmpty() && name == mWaitUntil && !mSawDocumentComplete) {
+		mSawDocumentComplete = true;
+		metric("load.trigger", name);
+		enterPhase(ReadyPhase);
+		updateViewportToContentThenMaybeCapture();
+	}
+}
+
+// Above-the-fold preview, written before the widget is grown to the page.
+void CutyCapt::savePreview() {
+	if (mPreview.isEmpty() || mPreviewDone)
+		return;
+	mPreviewDone = true;
+
+	const char* format = "png";
+	for (int ix = 0; CutyExtMap[ix].id != OtherFormat; ++ix) {
+		if (CutyExtMap[ix].id >= PngFormat && CutyExtMap[ix].id != AutoFormat &&
+		    mPreview.endsWith(CutyExtMap[ix].extension))
+			format = CutyExtMap[ix].identifier;
+	}
+
+	QImage image = mPage->grab().toImage();
+	if (image.width() > mPreviewWidth)
+		image = image.scaledToWidth(mPreviewWidth, Qt::FastTransformation);
+
+	if (writeImage(image, mPreview, format))
+		markMetric("preview.written_ms");
+}
+
+void CutyCapt::pdfPrintFinish(const QString& file, bool success) {
+	if (!success && !mSilent) {
+		std::cerr << "Failed to print page to PDF '" << file.toStdString() << "'" << std::endl;
+		done(1);
+		return;
+	}
+	done(0);
+}
+
+void CutyCapt::saveSnapshot() {
+	// A timeout policy may have started the capture while sizing or the
+	// delay was still under way.
+	if (mCaptureStarted)
+		return;
+
+	const char* format = nullptr;
+
+	for (int ix = 0; CutyExtMap[ix].id != OtherFormat; ++ix) {
+		if (CutyExtMap[ix].id == mFormat) {
+			format = CutyExtMap[ix].identifier;
+			break;
+		}
+	}
+
+	QString out = mOutput;
+	mTimeoutTimer.stop();
+	mPhaseTimer.stop();
+	// mCpuTimer keeps running: a page can turn busy while outputs are written.
+
+	// Sizing left the widget small for DevTools, which is gone since.
+	if (mDevTools && !mDevTools->isOpen()) {
+		recaptureWithoutDevTools();
+		return;
+	}
+	mRecapturing = false;
+	mCaptureStarted = true;
+	markMetric("capture.started_ms");
+	// Captures that skipped sizing still owe the preview.
+	savePreview();
+
+	if (mFrozenPid > 0) {
+		saveFrozenFrame(out);
+		return;
+	}
+
+	// Make sure we have some non-zero size.
+	if (mViewSize.isEmpty())
+		mViewSize = mPage->size();
+	if (mViewSize.isEmpty())
+		mViewSize = QSize(800, 600);
+
+	switch (mFormat) {
+		case SvgFormat: {
+			if (!mSvgTiles.isEmpty()) {
+				saveSvg(out);
+				break;
+			}
+			QPainter painter;
+			QSvgGenerator svg;
+			svg.setFileName(out);
+			svg.setSize(mViewSize);
+			painter.begin(&svg);
+			mPage->render(&painter);
+			painter.end();
+			done(0);
+			break;
+		}
+		case PdfFormat:
+		case PsFormat: {
+			// Qt6: async; observe QWebEnginePage::pdfPrintingFinished.
+			mPage->page()->printToPdf(out);
+			break;
+		}
+		case InnerTextFormat: {
+			mPage->page()->toPlainText([this, out](const QString& result) {
+				QFile file(out);
+				if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+					QTextStream s(&file);
+					s.setEncoding(QStringConverter::Utf8);
+					s << result;
+				}
+				done(0);
+			});
+			break;
+		}
+		case HtmlFormat: {
+			mPage->page()->toHtml([this, out](const QString& result) {
+				QFile file(out);
+				if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+					QTextStream s(&file);
+					s.setEncoding(QStringConverter::Utf8);
+					s << result;
+				}
+				done(0);
+			});
+			break;
+		}
+		default: {
+			mPendingStages = mFrames.isEmpty() ? 1 : 2;
+			if (!mClips.isEmpty() || !mClipSelectors.isEmpty()) {
+				saveClips(out, format);
+			} else if (mDevTools) {
+				saveScreenshot(out, format);
+			} else {
+				emit captured(saveRaster(grabImage(), out, format));
+				finishStage();
+			}
+			if (!mFrames.isEmpty())
+				saveFrames(out, format);
+		}
+	}
+}
+
+// "shot.png" with tag "3" becomes "shot-3.png"; suffix replaces ".png".
+static QString CaptSiblingPath(const QString& out, const QString& tag,
+                               const QString& suffix = QString()) {
+	const int dot = out.lastIndexOf(QLatin1Char('.'));
+	const int slash = out.lastIndexOf(QLatin1Char('/'));
+	const QString stem = dot > slash ? out.left(dot) : out;
+	return stem + QLatin1Char('-') + tag + (suffix.isNull() && dot > slash ? out.mid(dot) : suffix);
+}
+
+QImage CutyCapt::saveRaster(const QImage& grabbed, QString out, const char* format) {
+	QImage image = postProcess(grabbed);
+	int quality = -1;
+
+	if (mFormat == AutoFormat) {
+		format = chooseFormat(image, quality);
+
+		// Swap a raster (or .auto) suffix for the one of the chosen format.
+		for (int ix = 0; CutyExtMap[ix].id != OtherFormat; ++ix) {
+			if (CutyExtMap[ix].id >= PngFormat && out.endsWith(CutyExtMap[ix].extension)) {
+				out.chop(int(strlen(CutyExtMap[ix].extension)));
+				break;
+			}
+		}
+		out += QLatin1Char('.') + QLatin1String(format);
+		metric("auto.path", out);
+	}
+
+	// Hashed as grabbed, so output options do not change a page's hash.
+	if ((mPhashSidecar || !mPhashIndex.isEmpty()) && recordHash(grabbed, out) && mSkipDuplicates) {
+		if (!mSilent)
+			std::clog << "Near-duplicate capture not written" << std::endl;
+		return image;
+	}
+
+	if (writeImage(image, out, format, quality) && !mContactSheet.isEmpty())
+		addToContactSheet(image, out);
+	return image;
+}
+
+// Sheets are shared by all workers of a batch: the next free slot is read
+// from the current sheet's PNG text under a lock, the thumbnail drawn into
+// it and the sheet rewritten. A full sheet starts the next one, so the
+// full-size captures never have to be decoded again.
+void CutyCapt::addToContactSheet(const QImage& image, const QString& out) {
+	const int capacity = mContactColumns * mContactRows;
+	const int thumbHeight = mContactThumb * 3 / 4;
+	const int labelHeight = 18;
+	const int gap = 4;
+	const QSize cell(mContactThumb + gap, thumbHeight + labelHeight + gap);
+
+	// Tall full-page captures keep their top, at the thumbnail aspect.
+	const int sourceHeight = qMin(image.height(), image.width() * thumbHeight / mContactThumb);
+	const QImage thumb = image.copy(0, 0, image.width(), sourceHeight)
+	                         .scaled(mContactThumb, thumbHeight, Qt::KeepAspectRatio,
+	                                 Qt::SmoothTransformation)
+	                         .convertToFormat(QImage::Format_RGB32);
+
+	QLockFile lock(mContactSheet + QStringLiteral(".lock"));
+	lock.setStaleLockTime(30000);
+	if (!lock.lock())
+		return;
+
+	// Headers only; full sheets are skipped without decoding them.
+	int sheet = 1;
+	int slot = 0;
+	QString path;
+	for (;; ++sheet) {
+		path = CaptSiblingPath(mContactSheet, QString::number(sheet), ".png");
+		QImageReader reader(path);
+		if (!reader.canRead()) {
+			slot = 0;
+			break;
+		}
+		slot = reader.text(QStringLiteral("CutyCapt-Slots")).toInt();
+		if (slot < capacity)
+			break;
+	}
+
+	QImage page;
+	if (slot > 0)
+		page = QImage(path).convertToFormat(QImage::Format_RGB32);
+	if (page.isNull()) {
+		page = QImage(cell.width() * mContactColumns + gap, cell.height() * mContactRows + gap,
+		              QImage::Format_RGB32);
+		page.fill(Qt::white);
+		slot = 0;
+	}
+
+	const QPoint origin(gap + (slot % mContactColumns) * cell.width(),
+	                    gap + (slot / mContactColumns) * cell.height());
+
+	QPainter painter(&page);
+	painter.drawImage(origin, thumb);
+	painter.setPen(QColor(0x33, 0x33, 0x33));
+	QFont font = painter.font();
+	font.setPixelSize(11);
+	painter.setFont(font);
+	const QRect label(origin.x(), origin.y() + thumbHeight, mContactThumb, labelHeight);
+	painter.drawText(label, Qt::AlignLeft | Qt::AlignVCenter,
+	                 painter.fontMetrics().elidedText(QFileInfo(out).fileName(), Qt::ElideMiddle,
+	                                                  mContactThumb));
+	painter.end();
+
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly))
+		return;
+	QImageWriter writer(&file, "png");
+	writer.setText(QStringLiteral("CutyCapt-Slots"), QString::number(slot + 1));
+	if (writer.write(page))
+		file.commit();
+
+	metric("contact.sheet", path);
+	metric("contact.slot", slot + 1);
+}
+
+// The DevTools backend shoots the whole document without the widget ever
+// growing. When nothing needs the pixels in memory, Chromium's own PNG,
+// JPEG or WebP encoding is written as is.
+void CutyCapt::saveScreenshot(const QString& out, const char* format) {
+	const QRect rect = pageRect();
+	const bool encodable = mFormat == PngFormat || mFormat == JpegFormat || mFormat == WebpFormat;
+
+	if (!encodable || needsImage()) {
+		captureRegion(rect, [this, out, format](const QImage& image) {
+			emit captured(saveRaster(image, out, format));
+			finishStage();
+		});
+		return;
+	}
+
+	devToolsScreenshot(rect, format, [this, out, format](const QByteArray& data) {
+		if (data.isEmpty()) {
+			recaptureWithoutDevTools();
+			return;
+		}
+		QSaveFile file(out);
+		if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+			if (!mSilent)
+				std::cerr << "Failed to write '" << out.toStdString() << "'" << std::endl;
+		}
+		finishStage();
+	});
+}
+
+// Tiled SVG instead of QSvgGenerator's single uncompressed-style image.
+// With text, invisible but selectable runs from the DOM are overlaid.
+void CutyCapt::saveSvg(const QString& out) {
+	const auto write = [this, out](const QVariantList& runs) {
+		captureRegion(pageRect(), [this, out, runs](const QImage& grabbed) {
+			// Page units per image pixel; DevTools shots may be scaled.
+			const double unit = grabbed.isNull() ? 1.0 : double(pageRect().width()) / grabbed.width();
+			QPoint trimmed;
+			const QImage image = postProcess(grabbed, &trimmed);
+			if (!writeSvg(image, out, runs, unit, QPointF(trimmed) * unit) && !mSilent)
+				std::cerr << "Failed to write '" << out.toStdString() << "'" << std::endl;
+			done(0);
+		});
+	};
+
+	if (!mSvgText) {
+		write(QVariantList());
+		return;
+	}
+
+	// Words of each text node grouped into runs per line box, as
+	// [x, y, width, height, font size, text] in document coordinates.
+	const QString js = QStringLiteral(R"(
+		(function() {
+			const runs = [];
+			const walker = document.createTreeWalker(document.body || document.documentElement,
+			                                         NodeFilter.SHOW_TEXT);
+			const range = document.createRange();
+			for (let node = walker.nextNode(); node && runs.length < 50000; node = walker.nextNode()) {
+				const style = node.parentElement && getComputedStyle(node.parentElement);
+				if (!style || style.visibility === 'hidden' || style.display === 'none')
+					continue;
+				const size = parseFloat(style.fontSize) || 16;
+				const text = node.data;
+				const re = /\S+/g;
+				let run = null;
+				for (let m = re.exec(text); m; m = re.exec(text)) {
+					range.setStart(node, m.index);
+					range.setEnd(node, m.index + m[0].length);
+					const r = range.getBoundingClientRect();
+					if (!r.width || !r.height)
+						continue;
+					const x = r.left + window.scrollX;
+					const y = r.top + window.scrollY;
+					if (run && Math.abs(run[1] - y) < 1) {
+						run[2] = x + r.width - run[0];
+						run[5] += ' ' + m[0];
+					} else {
+						run = [x, y, r.width, r.height, size, m[0]];
+						runs.push(run);
+					}
+				}
+			}
+			return runs;
+		})()
+	)");
+	mPage->page()->runJavaScript(js, QWebEngineScript::ApplicationWorld,
+	                             [write](const QVariant& v) { write(v.toList()); });
+}
+
+// image is unit page units per pixel and starts at origin on the page.
+bool CutyCapt::writeSvg(const QImage& image, const QString& out, const QVariantList& runs,
+                        double unit, const QPointF& origin) {
+	if (image.isNull())
+		return false;
+
+	const QSizeF page = QSizeF(image.size()) * unit;
+
+	const QByteArray format = mSvgTiles == QLatin1String("webp") &&
+	                                  !QImageWriter::supportedImageFormats().contains("webp")
+	                              ? QByteArray("png")
+	                              : mSvgTiles.toLatin1();
+	const QByteArray mime = "image/" + format;
+	const QImage rgb = image.convertToFormat(QImage::Format_ARGB32);
+
+	QSaveFile file(out);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	QByteArray svg;
+	svg += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+	svg += QStringLiteral("<svg xmlns=\"http://www.w3.org/2000/svg\" "
+	                      "xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"%1\" height=\"%2\" "
+	                      "viewBox=\"0 0 %1 %2\">\n")
+	           .arg(page.width())
+	           .arg(page.height())
+	           .toUtf8();
+
+	// Uniform tiles become rects; tiles seen before are referenced by id.
+	QHash<QByteArray, QByteArray> seen;
+	int tiles = 0;
+	int reused = 0;
+	const int size = mSvgTileSize;
+	for (int ty = 0; ty < image.height(); ty += size) {
+		for (int tx = 0; tx < image.width(); tx += size) {
+			const QRect rect = QRect(tx, ty, size, size).intersected(image.rect());
+			const QByteArray place = QStringLiteral("x=\"%1\" y=\"%2\" width=\"%3\" height=\"%4\"")
+			                             .arg(rect.x() * unit)
+			                             .arg(rect.y() * unit)
+			                             .arg(rect.width() * unit)
+			                             .arg(rect.height() * unit)
+			                             .toUtf8();
+
+			const quint32 bg = reinterpret_cast<const quint32*>(rgb.constScanLine(rect.y()))[rect.x()];
+			bool uniform = true;
+			for (int y = rect.top(); uniform && y <= rect.bottom(); ++y) {
+				const quint32* row = reinterpret_cast<const quint32*>(rgb.constScanLine(y)) + rect.x();
+				uniform = CaptFirstForeground(row, rect.width(), bg, 0) == rect.width();
+			}
+			if (uniform && qAlpha(bg) == 255) {
+				svg += "<rect " + place + " fill=\"" + QColor(bg).name().toLatin1() + "\"/>\n";
+				continue;
+			}
+			if (uniform && qAlpha(bg) == 0)
+				continue;
+
+			QByteArray data;
+			QBuffer buffer(&data);
+			buffer.open(QIODevice::WriteOnly);
+			QImageWriter writer(&buffer, format);
+			if (format != "png")
+				writer.setQuality(mJpegQuality);
+			writer.write(image.copy(rect));
+
+			const QByteArray digest = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+			auto known = seen.constFind(digest);
+			if (known != seen.constEnd()) {
+				++reused;
+			} else {
+				// Defined once at the origin; every copy, the first
+				// included, is placed by its <use>.
+				const QByteArray id = "t" + QByteArray::number(tiles++);
+				known = seen.insert(digest, id);
+				svg += "<defs><image id=\"" + id + "\" " + place.mid(place.indexOf("width")) +
+				       " preserveAspectRatio=\"none\" xlink:href=\"data:" + mime + ";base64," +
+				       data.toBase64() + "\"/></defs>\n";
+			}
+			svg += "<use xlink:href=\"#" + known.value() + "\" " +
+			       QStringLiteral("x=\"%1\" y=\"%2\"/>\n").arg(rect.x() * unit).arg(rect.y() * unit).toUtf8();
+		}
+		file.write(svg);
+		svg.clear();
+	}
+
+	if (!runs.isEmpty()) {
+		svg += "<g fill-opacity=\"0\" font-family=\"sans-serif\">\n";
+		for (const QVariant& entry : runs) {
+			const QVariantList r = entry.toList();
+			if (r.size() != 6)
+				continue;
+			// Runs are in CSS pixels of the untrimmed page. Baseline at
+			// about 80% of the line box; textLength keeps selection
+			// boxes on the words whatever the fallback font.
+			const QRect box = fromCss(QRectF(r[0].toDouble(), r[1].toDouble(), r[2].toDouble(),
+			                                 r[3].toDouble()));
+			svg += QStringLiteral("<text x=\"%1\" y=\"%2\" font-size=\"%3\" textLength=\"%4\" "
+			                      "lengthAdjust=\"spacingAndGlyphs\">%5</text>\n")
+			           .arg(box.x() - origin.x())
+			           .arg(box.y() - origin.y() + box.height() * 0.8)
+			           .arg(r[4].toDouble() * mPage->zoomFactor())
+			           .arg(box.width())
+			           .arg(r[5].toString().toHtmlEscaped())
+			           .toUtf8();
+		}
+		svg += "</g>\n";
+	}
+
+	svg += "</svg>\n";
+	file.write(svg);
+
+	metric("svg.tiles", tiles);
+	metric("svg.reused", reused);
+	metric("svg.text_runs", int(runs.size()));
+	return file.commit();
+}
+
+// rect of the page as an image: grabbed from the widget, or shot through
+// DevTools, which also reaches beyond the viewport.
+void CutyCapt::captureRegion(const QRect& rect, const std::function<void(const QImage&)>& done) {
+	// Stages of a capture abandoned for the widget fallback.
+	if (mRecapturing)
+		return;
+
+	if (!mDevTools) {
+		done(mPage->grab(rect).toImage());
+		return;
+	}
+
+	devToolsScreenshot(rect, "png", [this, done](const QByteArray& data) {
+		const QImage image = QImage::fromData(data, "png");
+		if (image.isNull())
+			recaptureWithoutDevTools();
+		else if (!mRecapturing)
+			done(image);
+	});
+}
+
+// The widget is still at its initial size, so grabbing it now would
+// silently write the viewport only. Start over from sizing instead; the
+// delay has been waited out already.
+void CutyCapt::recaptureWithoutDevTools() {
+	if (mRecapturing)
+		return;
+
+	if (!mSilent)
+		std::cerr << "DevTools screenshot failed, capturing from the widget" << std::endl;
+	mRecapturing = true;
+	mCaptureStarted = false;
+	mDevTools = nullptr;
+	mDelay = 0;
+	mSawDocumentComplete = true;
+	metric("devtools.fallback", true);
+	updateViewportToContentThenMaybeCapture();
+}
+
+// done gets nothing if the DevTools connection is gone.
+void CutyCapt::devToolsScreenshot(const QRect& rect, const char* format,
+                                  const std::function<void(const QByteArray&)>& done) {
+	QJsonObject params{
+		{ "format", format },
+		{ "captureBeyondViewport", true },
+		{ "fromSurface", true },
+		{ "clip", QJsonObject{ { "x", rect.x() },
+		                       { "y", rect.y() },
+		                       { "width", rect.width() },
+		                       { "height", rect.height() },
+		                       { "scale", mScale } } },
+	};
+	if (strcmp(format, "png") != 0)
+		params.insert("quality", mJpegQuality);
+
+	mDevTools->send(QStringLiteral("Page.captureScreenshot"), params, [done](const QJsonObject& result) {
+		done(QByteArray::fromBase64(result.value("data").toString().toLatin1()));
+	});
+}
+
+// Area a capture can cover: the widget, or the measured document when the
+// DevTools backend leaves the widget at its initial size.
+QRect CutyCapt::pageRect() const {
+	return mDevTools ? QRect(QPoint(), mViewSize) : mPage->rect();
+}
+
+// Element rects come back in CSS pixels; the page is laid out zoomed.
+QRect CutyCapt::fromCss(const QRectF& rect) const {
+	const qreal zoom = mPage->zoomFactor();
+	return QRectF(rect.topLeft() * zoom, rect.size() * zoom).toAlignedRect();
+}
+
+// Whether anything after the capture looks at the decoded image.
+bool CutyCapt::needsImage() const {
+	return mAutotrim >= 0 || mColorMode != RgbColor || mQuantize > 0 || mRecompress ||
+	       mRenderProfile == CompactRender ||
+	       mPhashSidecar || !mPhashIndex.isEmpty() || !mContactSheet.isEmpty() ||
+	       (mFormat == JpegFormat && (mJpegSubsampling != 420 || mJpegProgressive || mJpegOptimize)) ||
+	       isSignalConnected(QMetaMethod::fromSignal(&CutyCapt::captured));
+}
+
+// One output per region, numbered in order: --clip rectangles first, then
+// every element matched by each --clip-selector. Regions are grabbed from the
+// widget directly so the full page is never materialized as one image.
+void CutyCapt::saveClips(const QString& out, const char* format) {
+	const QString js = QStringLiteral(R"(
+		(function(selectors) {
+			const rects = [];
+			for (const selector of selectors) {
+				let nodes = [];
+				try { nodes = document.querySelectorAll(selector); } catch (e) {}
+				for (const node of nodes) {
+					const r = node.getBoundingClientRect();
+					rects.push([r.left + window.scrollX, r.top + window.scrollY, r.width, r.height]);
+				}
+			}
+			return rects;
+		})(%1)
+	)").arg(QString::fromUtf8(QJsonDocument(QJsonArray::fromStringList(mClipSelectors))
+	                             .toJson(QJsonDocument::Compact)));
+
+	mPage->page()->runJavaScript(js, QWebEngineScript::ApplicationWorld, [this, out, format](const QVariant& v) {
+		QList<QRect> regions = mClips;
+		for (const QVariant& entry : v.toList()) {
+			const QVariantList r = entry.toList();
+			if (r.size() == 4) {
+				regions.append(fromCss(QRectF(r[0].toDouble(), r[1].toDouble(), r[2].toDouble(),
+				                              r[3].toDouble())));
+			}
+		}
+
+		int written = 0;
+		for (int ix = 0; ix < regions.size(); ++ix) {
+			const QRect rect = regions[ix].intersected(pageRect());
+			if (rect.isEmpty()) {
+				if (!mSilent)
+					std::clog << "Clip region " << (ix + 1) << " is outside the page" << std::endl;
+				continue;
+			}
+			const QString path = CaptSiblingPath(out, QString::number(ix + 1));
+			++mPendingStages;
+			captureRegion(rect, [this, path, format](const QImage& image) {
+				saveRaster(image, path, format);
+				finishStage();
+			});
+			++written;
+		}
+
+		if (!mSilent && regions.isEmpty())
+			std::clog << "No clip regions matched" << std::endl;
+
+		metric("clip.regions", int(regions.size()));
+		metric("clip.written", written);
+		finishStage();
+	});
+}
+
+// Screenshot each selected child frame clipped to its element, and record the
+// embedding context in <out>-frames.json. Frame documents are read through
+// QWebEngineFrame, which also reaches cross-origin frames.
+void CutyCapt::saveFrames(const QString& out, const char* format) {
+	const QString selector = mFrames == QLatin1String("all") ? QStringLiteral("iframe, frame") : mFrames;
+	const QString js = QStringLiteral(R"(
+		(function(selector) {
+			const frames = Array.from(document.querySelectorAll('iframe, frame'));
+			let picked = [];
+			try { picked = Array.from(document.querySelectorAll(selector)); } catch (e) {}
+			return picked.filter(function(node) { return frames.includes(node); }).map(function(node) {
+				const r = node.getBoundingClientRect();
+				return { name: node.name || '', src: node.src || '',
+				         x: r.left + window.scrollX, y: r.top + window.scrollY,
+				         width: r.width, height: r.height };
+			});
+		})(%1[0])
+	)").arg(QString::fromUtf8(QJsonDocument(QJsonArray{ selector }).toJson(QJsonDocument::Compact)));
+
+	mPage->page()->runJavaScript(js, QWebEngineScript::ApplicationWorld, [this, out, format](const QVariant& v) {
+		const QVariantList found = v.toList();
+		QJsonArray manifest;
+
+		int captured = 0;
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+		const QList<QWebEngineFrame> children = mPage->page()->mainFrame().children();
+		QSet<int> used;
+#else
+		if (!mFrameContent.isEmpty() && !mSilent)
+			std::cerr << "--frame-content requires Qt 6.8 or later" << std::endl;
+#endif
+
+		for (int ix = 0; ix < found.size(); ++ix) {
+			const QVariantMap f = found[ix].toMap();
+			const QString tag = QStringLiteral("frame-") + QString::number(ix + 1);
+			const QRect rect = fromCss(QRectF(f.value("x").toDouble(), f.value("y").toDouble(),
+			                                  f.value("width").toDouble(), f.value("height").toDouble()));
+
+			QJsonObject entry{
+				{ "name", f.value("name").toString() },
+				{ "src", f.value("src").toString() },
+				{ "x", rect.x() },
+				{ "y", rect.y() },
+				{ "width", rect.width() },
+				{ "height", rect.height() },
+			};
+
+			const QRect visible = rect.intersected(pageRect());
+			if (!visible.isEmpty()) {
+				const QString path = CaptSiblingPath(out, tag);
+				++mPendingStages;
+				captureRegion(visible, [this, path, format](const QImage& image) {
+					saveRaster(image, path, format);
+					finishStage();
+				});
+				entry.insert("image", path);
+				++captured;
+			}
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+			// Hidden, nested or script-inserted frames break any pairing by
+			// position, so frames are matched to elements by name, then by
+			// URL; without either the element gets no document.
+			const QString name = f.value("name").toString();
+			const QUrl src(f.value("src").toString());
+			int match = -1;
+			for (int cx = 0; cx < children.size() && match < 0; ++cx) {
+				if (!used.contains(cx) && !name.isEmpty() && children[cx].htmlName() == name)
+					match = cx;
+			}
+			for (int cx = 0; cx < children.size() && match < 0; ++cx) {
+				if (!used.contains(cx) && !src.isEmpty() && children[cx].url() == src)
+					match = cx;
+			}
+
+			if (match >= 0 && children[match].isValid()) {
+				used.insert(match);
+				QWebEngineFrame frame = children[match];
+				entry.insert("url", frame.url().toString());
+
+				if (!mFrameContent.isEmpty()) {
+					const bool html = mFrameContent == QLatin1String("html");
+					const QString path = CaptSiblingPath(out, tag, html ? ".html" : ".txt");
+					entry.insert(html ? "html" : "text", path);
+
+					++mPendingStages;
+					frame.runJavaScript(
+						html ? QStringLiteral("document.documentElement ? document.documentElement.outerHTML : ''")
+						     : QStringLiteral("document.body ? document.body.innerText : ''"),
+						QWebEngineScript::ApplicationWorld, [this, path](const QVariant& result) {
+							QFile file(path);
+							if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+								QTextStream s(&file);
+								s.setEncoding(QStringConverter::Utf8);
+								s << result.toString();
+							}
+							finishStage();
+						});
+				}
+			}
+#endif
+
+			manifest.append(entry);
+		}
+
+		QSaveFile file(CaptSiblingPath(out, QStringLiteral("frames"), ".json"));
+		if (file.open(QIODevice::WriteOnly)) {
+			file.write(QJsonDocument(manifest).toJson());
+			file.commit();
+		}
+
+		metric("frames.found", int(found.size()));
+		metric("frames.captured", captured);
+		finishStage();
+	});
+}
+
+void CutyCapt::finishStage() {
+	if (--mPendingStages <= 0)
+		done(0);
+}
+
+// The first outcome counts: a failed load may be followed by a timeout.
+void CutyCapt::done(int code) {
+	if (std::exchange(mDone, true))
+		return;
+
+	mTimeoutTimer.stop();
+	mPhaseTimer.stop();
+	mCpuTimer.stop();
+	mDeadlineTimer.stop();
+	finishRecordings(code);
+}
+
+// Recordings of the load are closed one after the other before finishing.
+void CutyCapt::finishRecordings(int code) {
+	if (mWarc) {
+		std::exchange(mWarc, nullptr)->finish([this, code] { finishRecordings(code); });
+		return;
+	}
+	if (mTrace) {
+		std::exchange(mTrace, nullptr)->finish([this, code] { finishRecordings(code); });
+		return;
+	}
+#if defined(Q_OS_LINUX)
+	if (mFrozenPid > 0)
+		kill(pid_t(std::exchange(mFrozenPid, 0)), SIGKILL);
+#endif
+	emit finished(code);
+}
+
+// Hash the capture, write the sidecar and append it to the shared index.
+// Returns true if the index already holds a near-duplicate.
+bool CutyCapt::recordHash(const QImage& image, const QString& out) {
+	const quint64 phash = CaptPerceptualHash(image);
+	const quint64 dhash = CaptDifferenceHash(image);
+	const QString hex = QStringLiteral("%1").arg(phash, 16, 16, QLatin1Char('0'));
+	const QString dhex = QStringLiteral("%1").arg(dhash, 16, 16, QLatin1Char('0'));
+	metric("phash.value", hex);
+	metric("phash.dhash", dhex);
+
+	if (mPhashSidecar) {
+		QSaveFile file(out + QStringLiteral(".phash"));
+		if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+			file.write(QStringLiteral("phash:%1 dhash:%2\n").arg(hex, dhex).toLatin1());
+			file.commit();
+		}
+	}
+
+	if (mPhashIndex.isEmpty())
+		return false;
+
+	// Index lines are "<phash> <dhash> <cluster> <path>". Workers of a batch
+	// share the file, so lookup and append happen under one lock. Every line
+	// is also filed in <index>.mih<distance>/ under its band buckets, and a
+	// lookup reads only the buckets of its own bands.
+	QLockFile lock(mPhashIndex + QStringLiteral(".lock"));
+	lock.setStaleLockTime(30000);
+	if (!lock.lock())
+		return false;
+
+	QFile index(mPhashIndex);
+	if (!index.open(QIODevice::ReadWrite | QIODevice::Append | QIODevice::Text)) {
+		if (!mSilent)
+			std::cerr << "Unable to open hash index '" << mPhashIndex.toStdString() << "'" << std::endl;
+		return false;
+	}
+
+	const QDir buckets(mPhashIndex + QStringLiteral(".mih%1").arg(mPhashDistance));
+	const QString countPath = buckets.filePath(QStringLiteral("entries"));
+	qint64 entries = 0;
+	QFile count(countPath);
+	if (count.open(QIODevice::ReadOnly)) {
+		entries = count.readAll().trimmed().toLongLong();
+		count.close();
+	} else {
+		// First lookup at this distance: file what the index already holds.
+		buckets.mkpath(QStringLiteral("."));
+		index.seek(0);
+		while (!index.atEnd()) {
+			const QByteArray line = index.readLine();
+			if (line.trimmed().split(' ').size() < 4)
+				continue;
+			CaptFileHashEntry(buckets, line, mPhashDistance);
+			++entries;
+		}
+	}
+
+	qint64 cluster = -1;
+	int bestDistance = 65;
+	QString bestPath;
+	for (const QString& name : CaptHashBuckets(phash, mPhashDistance)) {
+		QFile bucket(buckets.filePath(name));
+		if (!bucket.open(QIODevice::ReadOnly | QIODevice::Text))
+			continue;
+		while (!bucket.atEnd()) {
+			const QList<QByteArray> fields = bucket.readLine().trimmed().split(' ');
+			if (fields.size() < 4)
+				continue;
+
+			bool ok = false;
+			bool dok = false;
+			const quint64 other = fields[0].toULongLong(&ok, 16);
+			const quint64 otherDhash = fields[1].toULongLong(&dok, 16);
+			if (!ok || !dok)
+				continue;
+			// The dHash, built from gradients rather than frequencies,
+			// has to agree at the same distance.
+			const int distance = qPopulationCount(phash ^ other);
+			if (distance <= mPhashDistance && distance < bestDistance &&
+			    int(qPopulationCount(dhash ^ otherDhash)) <= mPhashDistance) {
+				bestDistance = distance;
+				cluster = fields[2].toLongLong();
+				bestPath = QString::fromUtf8(fields.mid(3).join(' '));
+			}
+		}
+	}
+
+	const bool duplicate = cluster >= 0;
+	if (!duplicate)
+		cluster = entries;
+
+	const QByteArray line =
+		QStringLiteral("%1 %2 %3 %4\n").arg(hex, dhex).arg(cluster).arg(out).toUtf8();
+	index.write(line);
+	index.close();
+	CaptFileHashEntry(buckets, line, mPhashDistance);
+
+	QSaveFile counter(countPath);
+	if (counter.open(QIODevice::WriteOnly)) {
+		counter.write(QByteArray::number(entries + 1) + '\n');
+		counter.commit();
+	}
+
+	metric("phash.cluster", cluster);
+	if (duplicate) {
+		metric("phash.duplicate_of", bestPath);
+		metric("phash.distance", bestDistance);
+		if (!mSilent) {
+			std::clog << "Near-duplicate of '" << bestPath.toStdString() << "' (distance "
+			          << bestDistance << ")" << std::endl;
+		}
+	}
+	return duplicate;
+}
+
+// Pick the smallest format that keeps text and flat areas sharp: palette
+// PNG when the colours fit, lossless for text-heavy pages and lossy
+// (WebP if Qt can write it, otherwise JPEG) once photos dominate.
+const char* CutyCapt::chooseFormat(QImage& image, int& quality) {
+	static const bool webp = QImageWriter::supportedImageFormats().contains("webp");
+	const char* format = "png";
+	quality = -1;
+
+	if (image.format() == QImage::Format_Mono || image.format() == QImage::Format_Indexed8) {
+		metric("auto.format", QStringLiteral("png"));
+		return format;
+	}
+
+	const QImage rgb = image.depth() == 32 ? image : image.convertToFormat(QImage::Format_RGB32);
+	std::vector<QRgb> colors;
+	const bool fewColors =
+		image.format() != QImage::Format_Grayscale8 && CaptExactColors(rgb, 256, colors);
+
+	double photoFraction = 0;
+	double edgeDensity = 0;
+	CaptAnalyze(rgb, photoFraction, edgeDensity);
+	metric("auto.photo_fraction", photoFraction);
+	metric("auto.edge_density", edgeDensity);
+
+	QString decision;
+	if (fewColors) {
+		image = CaptQuantize(image, 256, false);
+		decision = QStringLiteral("png8");
+	} else if (photoFraction >= 0.6 || (photoFraction >= 0.3 && edgeDensity < 0.02)) {
+		format = webp ? "webp" : "jpeg";
+		quality = mJpegQuality;
+		decision = webp ? QStringLiteral("webp-lossy") : QStringLiteral("jpeg");
+	} else if (webp) {
+		// Qt's WebP plugin switches to lossless coding at quality 100.
+		format = "webp";
+		quality = 100;
+		decision = QStringLiteral("webp-lossless");
+	} else {
+		decision = QStringLiteral("png");
+	}
+
+	metric("auto.format", decision);
+	if (!mSilent)
+		std::clog << "Automatic output format: " << decision.toStdString() << std::endl;
+
+	return format;
+}
+
+QImage CutyCapt::grabImage() {
+	// Prefer grab() for QWidget-backed rendering.
+	// (render() can sometimes race WebEngine painting depending on platform)
+	QPixmap px = mPage->grab();
+	if (!px.isNull())
+		return px.toImage();
+
+	// If grab fails for any reason, fall back to render into QImage.
+	QPainter painter;
+	QImage image(mViewSize,
+	             mRenderProfile == CompactRender ? QImage::Format_RGB32 : QImage::Format_ARGB32);
+	image.fill(mRenderProfile == CompactRender ? Qt::white : Qt::transparent);
+	painter.begin(&image);
+	if (mSmooth) {
+		painter.setRenderHint(QPainter::SmoothPixmapTransform);
+		painter.setRenderHint(QPainter::Antialiasing);
+		painter.setRenderHint(QPainter::TextAntialiasing);
+	}
+	mPage->render(&painter);
+	painter.end();
+	return image;
+}
+
+QImage CutyCapt::postProcess(QImage image, QPoint* trimmed) {
+	// Alpha that is opaque everywhere still costs a channel in PNG.
+	if (mRenderProfile == CompactRender && image.hasAlphaChannel())
+		image = image.convertToFormat(QImage::Format_RGB32);
+
+	if (mAutotrim >= 0 && !image.isNull()) {
+		if (image.depth() != 32)
+			image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+		const QRect box = CaptContentRect(image, mAutotrim);
+		if (!box.isNull() && box != image.rect()) {
+			if (!mSilent) {
+				std::clog << "Trimmed " << image.width() << "x" << image.height() << " to "
+				          << box.width() << "x" << box.height() << std::endl;
+			}
+			image = image.copy(box);
+			if (trimmed)
+				*trimmed = box.topLeft();
+		}
+		metric("trim.width", image.width());
+		metric("trim.height", image.height());
+	}
+
+	if (mColorMode == GrayColor && !image.isNull()) {
+		image = CaptGrayscale(image);
+	} else if (mColorMode == BilevelColor && !image.isNull()) {
+		int threshold = -1;
+		image = CaptBilevel(image, mThreshold, &threshold);
+		if (threshold >= 0)
+			metric("color.threshold", threshold);
+	}
+
+	if (mQuantize > 0 && mColorMode == RgbColor && !image.isNull()) {
+		bool exact = false;
+		image = CaptQuantize(image, mQuantize, mDither, &exact);
+		metric("quantize.exact", exact);
+		metric("quantize.colors", int(image.colorCount()));
+	}
+
+	return image;
+}
+
+bool CutyCapt::writeImage(const QImage& image, const QString& path, const char* format,
+                          int quality) {
+	bool ok = false;
+
+	if (qstrcmp(format, "gif") == 0) {
+		if (image.width() > 0xffff || image.height() > 0xffff) {
+			if (!mSilent)
+				std::cerr << "Image too large for GIF '" << path.toStdString() << "'" << std::endl;
+			return false;
+		}
+
+		const QImage indexed = image.format() == QImage::Format_Indexed8
+		                           ? image
+		                           : CaptQuantize(image, 256, mDither);
+		QSaveFile file(path);
+		ok = file.open(QIODevice::WriteOnly) && file.write(CaptEncodeGif(indexed)) >= 0 &&
+		     file.commit();
+	} else if (qstrcmp(format, "jpeg") == 0) {
+		ok = writeJpeg(image, path);
+	} else if (mRecompress && qstrcmp(format, "png") == 0) {
+		// Cheap deflate now; the detached worker does the exhaustive pass.
+		ok = image.save(path, format, quality < 0 ? 80 : quality);
+		if (ok) {
+			QStringList args{ QStringLiteral("--recompress-png=") + path };
+			if (mSilent)
+				args << QStringLiteral("--silent");
+			QProcess::startDetached(QCoreApplication::applicationFilePath(), args);
+			metric("recompress.queued", path);
+		}
+	} else {
+		ok = image.save(path, format, quality);
+	}
+
+	if (!ok && !mSilent)
+		std::cerr << "Failed to save image '" << path.toStdString() << "'" << std::endl;
+	return ok;
+}
+
+bool CutyCapt::writeJpeg(const QImage& image, const QString& path) {
+#if CUTYCAPT_LIBJPEG
+	// Hand libjpeg a layout it reads directly; everything else is converted.
+	QImage input = image;
+	switch (image.format()) {
+		case QImage::Format_Grayscale8:
+		case QImage::Format_RGB888:
+			break;
+#ifdef JCS_EXTENSIONS
+		case QImage::Format_RGB32:
+		case QImage::Format_ARGB32:
+		case QImage::Format_ARGB32_Premultiplied:
+			break;
+		case QImage::Format_Mono:
+			input = image.convertToFormat(QImage::Format_Grayscale8);
+			break;
+		default:
+			input = image.convertToFormat(QImage::Format_RGB32);
+			break;
+#else
+		case QImage::Format_Mono:
+			input = image.convertToFormat(QImage::Format_Grayscale8);
+			break;
+		default:
+			input = image.convertToFormat(QImage::Format_RGB888);
+			break;
+#endif
+	}
+
+	unsigned char* data = nullptr;
+	unsigned long size = 0;
+	const bool encoded = CaptEncodeJpeg(input, mJpegQuality, mJpegSubsampling, mJpegProgressive,
+	                                    mJpegOptimize, &data, &size);
+
+	bool ok = false;
+	if (encoded) {
+		QSaveFile file(path);
+		ok = file.open(QIODevice::WriteOnly) &&
+		     file.write(reinterpret_cast<const char*>(data), qint64(size)) == qint64(size) &&
+		     file.commit();
+	}
+	free(data);
+	return ok;
+#else
+	// Qt's JPEG plugin offers no control over chroma subsampling.
+	QImageWriter writer(path, "jpeg");
+	writer.setQuality(mJpegQuality);
+	writer.setProgressiveScanWrite(mJpegProgressive);
+	writer.setOptimizedWrite(mJpegOptimize);
+	return writer.write(image);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////
+// CutyCompare
+////////////////////////////////////////////////////////////////////
+
+CutyCompare::CutyCompare(CutyCapt* a, CutyCapt* b, const QString& diffPath, int tolerance,
+                         bool silent)
+	: mDiffPath(diffPath),
+	  mTolerance(tolerance),
+	  mSilent(silent) {
+	QObject::connect(a, &CutyCapt::captured, this, [this](const QImage& image) { mImages[0] = image; });
+	QObject::connect(b, &CutyCapt::captured, this, [this](const QImage& image) { mImages[1] = image; });
+	QObject::connect(a, &CutyCapt::finished, this, [this](int code) { finish(0, code); });
+	QObject::connect(b, &CutyCapt::finished, this, [this](int code) { finish(1, code); });
+}
+
+void CutyCompare::finish(int index, int code) {
+	if (std::exchange(mFinished[index], true))
+		return;
+
+	mCode = qMax(mCode, code);
+	if (!mFinished[0] || !mFinished[1])
+		return;
+
+	if (mImages[0].isNull() || mImages[1].isNull()) {
+		if (!mSilent)
+			std::cerr << "Comparison needs a raster capture of both pages" << std::endl;
+		QApplication::exit(qMax(mCode, 1));
+		return;
+	}
+
+	QImage diff;
+	const qint64 changed = CaptDiff(mImages[0], mImages[1], mTolerance, diff);
+	const double score = double(changed) / (qint64(diff.width()) * diff.height());
+
+	if (!diff.save(mDiffPath, "png") && !mSilent)
+		std::cerr << "Failed to write diff '" << mDiffPath.toStdString() << "'" << std::endl;
+
+	CutyMetrics::set("compare.width", diff.width());
+	CutyMetrics::set("compare.height", diff.height());
+	CutyMetrics::set("compare.changed", double(changed));
+	CutyMetrics::set("compare.score", score);
+
+	if (!mSilent)
+		std::clog << "Changed pixels: " << changed << " (" << score << ")" << std::endl;
+
+	QApplication::exit(mCode);
+}
+
+////////////////////////////////////////////////////////////////////
+// CutyDevTools
+////////////////////////////////////////////////////////////////////
+
+CutyDevTools::CutyDevTools(quint16 port, QWebEnginePage* page, QObject* parent)
+	: QObject(parent),
+	  mPort(port),
+	  mPage(page) {
+	QObject::connect(&mSocket, &QTcpSocket::readyRead, this, &CutyDevTools::readSocket);
+	QObject::connect(&mSocket, &QTcpSocket::errorOccurred, this,
+	                 [this] { fail(mSocket.errorString()); });
+}
+
+void CutyDevTools::open() {
+	discover(0);
+}
+
+bool CutyDevTools::isOpen() const {
+	return mOpen;
+}
+
+void CutyDevTools::fail(const QString& reason) {
+	mOpen = false;
+	mSocket.abort();
+	const QHash<int, Callback> pending = std::exchange(mPending, {});
+	for (const Callback& done : pending)
+		done(QJsonObject());
+	emit failed(reason);
+}
+
+// The endpoint comes up with the browser context, so the first requests
+// may be refused. The page's target is the one with its devToolsId.
+void CutyDevTools::discover(int attempt) {
+	auto* network = new QNetworkAccessManager(this);
+	QNetworkReply* reply = network->get(
+		QNetworkRequest(QUrl(QStringLiteral("http://127.0.0.1:%1/json/list").arg(mPort))));
+
+	QObject::connect(reply, &QNetworkReply::finished, this, [this, network, reply, attempt] {
+		reply->deleteLater();
+		network->deleteLater();
+
+		if (reply->error() != QNetworkReply::NoError) {
+			if (attempt < 50)
+				QTimer::singleShot(100, this, [this, attempt] { discover(attempt + 1); });
+			else
+				emit failed(reply->errorString());
+			return;
+		}
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+		const QString id = mPage->devToolsId();
+#else
+		const QString id;
+#endif
+		QUrl url;
+		for (const QJsonValue& value : QJsonDocument::fromJson(reply->readAll()).array()) {
+			const QJsonObject target = value.toObject();
+			if (target.value("type").toString() == QLatin1String("page") &&
+			    (id.isEmpty() || target.value("id").toString() == id)) {
+				url = QUrl(target.value("webSocketDebuggerUrl").toString());
+				break;
+			}
+		}
+
+		if (!url.isValid()) {
+			emit failed(QStringLiteral("no DevTools target for the page"));
+			return;
+		}
+
+		QByteArray nonce(16, '\0');
+		for (char& c : nonce)
+			c = char(QRandomGenerator::global()->bounded(256));
+
+		mKey = nonce.toBase64();
+		const QByteArray upgrade = "GET " + url.path().toUtf8() + " HTTP/1.1\r\n"
+		                           "Host: " + url.authority().toUtf8() + "\r\n"
+		                           "Upgrade: websocket\r\n"
+		                           "Connection: Upgrade\r\n"
+		                           "Sec-WebSocket-Key: " + mKey + "\r\n"
+		                           "Sec-WebSocket-Version: 13\r\n\r\n";
+		QObject::connect(&mSocket, &QTcpSocket::connected, this,
+		                 [this, upgrade] { mSocket.write(upgrade); }, Qt::SingleShotConnection);
+		mSocket.connectToHost(url.host(), quint16(url.port()));
+	});
+}
+
+void CutyDevTools::readSocket() {
+	mBuffer += mSocket.readAll();
+
+	if (!mOpen) {
+		const int end = mBuffer.indexOf("\r\n\r\n");
+		if (end < 0)
+			return;
+
+		const QByteArray accept =
+			QCryptographicHash::hash(mKey + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11",
+			                         QCryptographicHash::Sha1).toBase64();
+		const QByteArray head = mBuffer.left(end);
+		mBuffer.remove(0, end + 4);
+
+		if (!head.startsWith("HTTP/1.1 101") || !head.contains(accept)) {
+			fail(QStringLiteral("WebSocket upgrade refused"));
+			return;
+		}
+
+		mOpen = true;
+		emit ready();
+	}
+
+	// Server frames are unmasked; lengths use the 7/16/64-bit forms.
+	while (mBuffer.size() >= 2) {
+		const uchar b0 = uchar(mBuffer[0]);
+		const uchar b1 = uchar(mBuffer[1]);
+		qint64 length = b1 & 0x7f;
+		int header = 2;
+		if (length == 126) {
+			if (mBuffer.size() < 4)
+				return;
+			length = (uchar(mBuffer[2]) << 8) | uchar(mBuffer[3]);
+			header = 4;
+		} else if (length == 127) {
+			if (mBuffer.size() < 10)
+				return;
+			length = 0;
+			for (int ix = 2; ix < 10; ++ix)
+				length = (length << 8) | uchar(mBuffer[ix]);
+			header = 10;
+		}
+		if (mBuffer.size() < header + length)
+			return;
+
+		const QByteArray payload = mBuffer.mid(header, length);
+		mBuffer.remove(0, header + length);
+
+		switch (b0 & 0x0f) {
+			case 0x0:
+			case 0x1:
+				mMessage += payload;
+				if (b0 & 0x80) {
+					dispatch(mMessage);
+					mMessage.clear();
+				}
+				break;
+			case 0x8:
+				fail(QStringLiteral("DevTools connection closed"));
+				return;
+			case 0x9:
+				sendFrame(0xa, payload);
+				break;
+		}
+	}
+}
+
+// Client frames must be masked.
+void CutyDevTools::sendFrame(int opcode, const QByteArray& payload) {
+	QByteArray frame;
+	frame.append(char(0x80 | opcode));
+	if (payload.size() < 126) {
+		frame.append(char(0x80 | payload.size()));
+	} else if (payload.size() < 65536) {
+		frame.append(char(0x80 | 126));
+		frame.append(char(payload.size() >> 8));
+		frame.append(char(payload.size()));
+	} else {
+		frame.append(char(0x80 | 127));
+		for (int shift = 56; shift >= 0; shift -= 8)
+			frame.append(char(quint64(payload.size()) >> shift));
+	}
+
+	const quint32 mask = QRandomGenerator::global()->generate();
+	const char key[4] = { char(mask >> 24), char(mask >> 16), char(mask >> 8), char(mask) };
+	frame.append(key, 4);
+
+	const qsizetype start = frame.size();
+	frame.append(payload);
+	for (qsizetype ix = 0; ix < payload.size(); ++ix)
+		frame[start + ix] = char(frame[start + ix] ^ key[ix & 3]);
+
+	mSocket.write(frame);
+}
+
+void CutyDevTools::send(const QString& method, const QJsonObject& params, const Callback& done) {
+	if (!mOpen) {
+		if (done)
+			done(QJsonObject());
+		return;
+	}
+
+	const int id = mNextId++;
+	if (done)
+		mPending.insert(id, done);
+
+	const QJsonObject message{ { "id", id }, { "method", method }, { "params", params } };
+	sendFrame(0x1, QJsonDocument(message).toJson(QJsonDocument::Compact));
+}
+
+void CutyDevTools::dispatch(const QByteArray& message) {
+	const QJsonObject object = QJsonDocument::fromJson(message).object();
+
+	if (object.contains("id")) {
+		const Callback done = mPending.take(object.value("id").toInt());
+		if (done)
+			done(object.value("result").toObject());
+		return;
+	}
+
+	emit eventReceived(object.value("method").toString(), object.value("params").toObject());
+}
+
+////////////////////////////////////////////////////////////////////
+// CutyWarc
+////////////////////////////////////////////////////////////////////
+
+// RFC 4648 base32, the customary encoding of WARC SHA-1 digests.
+static QByteArray CaptBase32(const QByteArray& data) {
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+	QByteArray out;
+	quint32 buffer = 0;
+	int bits = 0;
+	for (const char c : data) {
+		buffer = (buffer << 8) | uchar(c);
+		bits += 8;
+		while (bits >= 5) {
+			out.append(alphabet[(buffer >> (bits - 5)) & 31]);
+			bits -= 5;
+		}
+	}
+	if (bits > 0)
+		out.append(alphabet[(buffer << (5 - bits)) & 31]);
+	while (out.size() % 8)
+		out.append('=');
+	return out;
+}
+
+static QByteArray CaptSha1(const QByteArray& data) {
+	return "sha1:" + CaptBase32(QCryptographicHash::hash(data, QCryptographicHash::Sha1));
+}
+
+// DevTools reports a header repeated as one value joined by newlines.
+static void CaptHttpHeaders(QByteArray& block, const QJsonObject& headers, bool decoded) {
+	for (auto it = headers.begin(); it != headers.end(); ++it) {
+		// Bodies come back decoded and whole, so framing headers would lie.
+		const QString name = it.key().toLower();
+		if (decoded && (name == QLatin1String("content-encoding") ||
+		                name == QLatin1String("transfer-encoding") ||
+		                name == QLatin1String("content-length")))
+			continue;
+		for (const QString& value : it.value().toString().split(QLatin1Char('\n')))
+			block += it.key().toUtf8() + ": " + value.toUtf8() + "\r\n";
+	}
+}
+
+// Network.getResponseBody hands text back already decoded to a string, so
+// the payload recorded is its UTF-8 transcoding, not the bytes served; the
+// header charset (which wins over any <meta charset>) is made to match.
+static void CaptUtf8ContentType(QJsonObject& headers) {
+	for (auto it = headers.begin(); it != headers.end(); ++it) {
+		if (it.key().compare(QLatin1String("content-type"), Qt::CaseInsensitive) != 0)
+			continue;
+		QStringList params = it.value().toString().split(QLatin1Char(';'));
+		for (int ix = params.size() - 1; ix > 0; --ix) {
+			if (params[ix].trimmed().startsWith(QLatin1String("charset="), Qt::CaseInsensitive))
+				params.removeAt(ix);
+		}
+		params.append(QStringLiteral(" charset=utf-8"));
+		it.value() = params.join(QLatin1Char(';'));
+		return;
+	}
+}
+
+CutyWarc::CutyWarc(CutyDevTools* devTools, const QString& path, const QString& index, bool silent,
+                   QObject* parent)
+	: QObject(parent),
+	  mDevTools(devTools),
+	  mPath(path),
+	  mIndex(index),
+	  mFile(path),
+	  mSilent(silent) {
+#if CUTYCAPT_ZLIB
+	mGzip = path.endsWith(QLatin1String(".gz"));
+#endif
+	QObject::connect(mDevTools, &CutyDevTools::eventReceived, this, &CutyWarc::onEvent);
+}
+
+void CutyWarc::start(const std::function<void()>& started) {
+	if (!mFile.open(QIODevice::WriteOnly)) {
+		if (!mSilent)
+			std::cerr << "Unable to open WARC '" << mPath.toStdString() << "'" << std::endl;
+		started();
+		return;
+	}
+
+	// Index lines are "<payload digest> <date> <uri>".
+	if (!mIndex.isEmpty()) {
+		QFile index(mIndex);
+		if (index.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			while (!index.atEnd()) {
+				const QByteArray line = index.readLine().trimmed();
+				const int space = line.indexOf(' ');
+				if (space > 0)
+					mDigests.insert(line.left(space), line.mid(space + 1));
+			}
+		}
+	}
+
+	const QString now = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+	writeRecord("warcinfo", QString(), now, { "Content-Type: application/warc-fields" },
+	            "software: CutyCapt\r\nformat: WARC File Format 1.1\r\n");
+
+	mDevTools->send(QStringLiteral("Network.enable"),
+	                QJsonObject{ { "maxResourceBufferSize", 64 << 20 },
+	                             { "maxTotalBufferSize", 256 << 20 } },
+	                [started](const QJsonObject&) { started(); });
+}
+
+void CutyWarc::onEvent(const QString& method, const QJsonObject& params) {
+	if (!mFile.isOpen())
+		return;
+
+	const QString id = params.value("requestId").toString();
+
+	if (method == QLatin1String("Network.requestWillBeSent")) {
+		const QJsonObject request = params.value("request").toObject();
+		if (!request.value("url").toString().startsWith(QLatin1String("http")))
+			return;
+
+		// A redirect reuses the request id; its response has no body.
+		if (params.contains("redirectResponse") && mExchanges.contains(id)) {
+			Exchange redirect = mExchanges.value(id);
+			redirect.response = params.value("redirectResponse").toObject();
+			record(redirect, QByteArray());
+		}
+
+		const qint64 ms = qint64(params.value("wallTime").toDouble() * 1000);
+		mExchanges.insert(id, Exchange{ request, QJsonObject(),
+		                                QDateTime::fromMSecsSinceEpoch(ms).toUTC().toString(Qt::ISODate) });
+	} else if (method == QLatin1String("Network.responseReceived")) {
+		if (mExchanges.contains(id))
+			mExchanges[id].response = params.value("response").toObject();
+	} else if (method == QLatin1String("Network.loadingFailed")) {
+		mExchanges.remove(id);
+		closeIfSettled();
+	} else if (method == QLatin1String("Network.loadingFinished")) {
+		if (!mExchanges.contains(id))
+			return;
+
+		++mPendingBodies;
+		mDevTools->send(QStringLiteral("Network.getResponseBody"), QJsonObject{ { "requestId", id } },
+		                [this, id](const QJsonObject& result) {
+			                const Exchange exchange = mExchanges.take(id);
+			                if (mFile.isOpen() && !result.isEmpty() && !exchange.response.isEmpty()) {
+				                const QString body = result.value("body").toString();
+				                if (result.value("base64Encoded").toBool())
+					                record(exchange, QByteArray::fromBase64(body.toLatin1()));
+				                else
+					                record(exchange, body.toUtf8(), true);
+			                }
+			                --mPendingBodies;
+			                closeIfSettled();
+		                });
+	}
+}
+
+// A response (or revisit) record plus the request record concurrent to it.
+void CutyWarc::record(const Exchange& exchange, const QByteArray& body, bool transcoded) {
+	const QJsonObject& request = exchange.request;
+	const QJsonObject& response = exchange.response;
+	const QString uri = request.value("url").toString();
+
+	QJsonObject responseHeaders = response.value("headers").toObject();
+	if (transcoded)
+		CaptUtf8ContentType(responseHeaders);
+
+	QByteArray head = "HTTP/1.1 " + QByteArray::number(response.value("status").toInt()) + " " +
+	                  response.value("statusText").toString().toUtf8() + "\r\n";
+	CaptHttpHeaders(head, responseHeaders, true);
+	head += "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+
+	const QByteArray digest = CaptSha1(body);
+	const auto original = mDigests.constFind(digest);
+	QByteArray id;
+
+	if (!body.isEmpty() && original != mDigests.constEnd()) {
+		const QByteArray refers = original.value();
+		const int space = refers.indexOf(' ');
+		id = writeRecord("revisit", uri, exchange.date,
+		                 { "Content-Type: application/http;msgtype=response",
+		                   "WARC-Profile: http://netpreserve.org/warc/1.1/revisit/identical-payload-digest",
+		                   "WARC-Refers-To-Target-URI: " + refers.mid(space + 1),
+		                   "WARC-Refers-To-Date: " + refers.left(space),
+		                   "WARC-Payload-Digest: " + digest },
+		                 head);
+		++mRevisits;
+	} else {
+		id = writeRecord("response", uri, exchange.date,
+		                 { "Content-Type: application/http;msgtype=response",
+		                   "WARC-Payload-Digest: " + digest },
+		                 head + body);
+		if (!body.isEmpty()) {
+			const QByteArray where = exchange.date.toUtf8() + " " + uri.toUtf8();
+			mDigests.insert(digest, where);
+			mNewDigests.append(digest + " " + where);
+		}
+	}
+
+	const QUrl url(uri);
+	QByteArray target = url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment);
+	if (target.isEmpty())
+		target = "/";
+	QByteArray block = request.value("method").toString().toUtf8() + " " + target + " HTTP/1.1\r\n";
+	const QJsonObject headers = request.value("headers").toObject();
+	if (!headers.contains("Host"))
+		block += "Host: " + url.authority().toUtf8() + "\r\n";
+	CaptHttpHeaders(block, headers, false);
+	block += "\r\n" + request.value("postData").toString().toUtf8();
+
+	writeRecord("request", uri, exchange.date,
+	            { "Content-Type: application/http;msgtype=request", "WARC-Concurrent-To: " + id },
+	            block);
+	++mRecords;
+}
+
+// Returns the record id. In .warc.gz files every record is its own gzip
+// member, as WARC readers expect.
+QByteArray CutyWarc::writeRecord(const QByteArray& type, const QString& uri, const QString& date,
+                                 const QList<QByteArray>& fields, const QByteArray& block) {
+	const QByteArray id = "<urn:uuid:" + QUuid::createUuid().toByteArray(QUuid::WithoutBraces) + ">";
+
+	QByteArray record = "WARC/1.1\r\nWARC-Type: " + type + "\r\nWARC-Record-ID: " + id +
+	                    "\r\nWARC-Date: " + date.toUtf8() + "\r\n";
+	if (!uri.isEmpty())
+		record += "WARC-Target-URI: " + uri.toUtf8() + "\r\n";
+	for (const QByteArray& field : fields)
+		record += field + "\r\n";
+	record += "WARC-Block-Digest: " + CaptSha1(block) + "\r\n";
+	record += "Content-Length: " + QByteArray::number(block.size()) + "\r\n\r\n";
+	record += block + "\r\n\r\n";
+
+#if CUTYCAPT_ZLIB
+	if (mGzip)
+		record = CaptDeflate(record, Z_DEFAULT_STRATEGY, 15 + 16);
+#endif
+	mFile.write(record);
+	return id;
+}
+
+void CutyWarc::finish(const std::function<void()>& done) {
+	mDone = done;
+	if (closeIfSettled())
+		return;
+
+	// Exchanges still in flight get a moment; the rest are dropped.
+	QTimer::singleShot(3000, this, [this] {
+		if (mDone)
+			close();
+	});
+}
+
+// Once finishing, close as soon as no exchange is waiting for its body.
+bool CutyWarc::closeIfSettled() {
+	if (!mDone || mPendingBodies > 0 || !mExchanges.isEmpty())
+		return false;
+	close();
+	return true;
+}
+
+void CutyWarc::close() {
+	if (mFile.isOpen()) {
+		mFile.close();
+		CutyMetrics::set("warc.records", mRecords);
+		CutyMetrics::set("warc.revisits", mRevisits);
+	}
+
+	// Other workers append to the same index.
+	if (!mIndex.isEmpty() && !mNewDigests.isEmpty()) {
+		QLockFile lock(mIndex + QStringLiteral(".lock"));
+		lock.setStaleLockTime(30000);
+		QFile index(mIndex);
+		if (lock.lock() && index.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+			for (const QByteArray& line : std::as_const(mNewDigests))
+				index.write(line + "\n");
+		}
+		mNewDigests.clear();
+	}
+
+	const std::function<void()> done = mDone;
+	mDone = nullptr;
+	if (done)
+		done();
+}
+
+////////////////////////////////////////////////////////////////////
+// CutyTrace
+////////////////////////////////////////////////////////////////////
+
+CutyTrace::CutyTrace(CutyDevTools* devTools, const QString& path, const QStringList& categories,
+                     bool silent, QObject* parent)
+	: QObject(parent),
+	  mDevTools(devTools),
+	  mPath(path),
+	  mCategories(categories),
+	  mFile(path),
+	  mSilent(silent) {
+	QObject::connect(mDevTools, &CutyDevTools::eventReceived, this, &CutyTrace::onEvent);
+}
+
+void CutyTrace::start(const std::function<void()>& started) {
+	if (!mFile.open(QIODevice::WriteOnly)) {
+		if (!mSilent)
+			std::cerr << "Unable to open trace '" << mPath.toStdString() << "'" << std::endl;
+		started();
 		return;
-	} else if (!mSilent) {
-		std::cerr << "WebEngine finished loadFinished(true)" << std::endl;
 	}
+	mFile.write("{\"traceEvents\":[\n");
 
-	mSawDocumentComplete = true;
+	// "-name" excludes a category, as in chrome://tracing.
+	QJsonArray included;
+	QJsonArray excluded;
+	for (const QString& category : std::as_const(mCategories)) {
+		if (category.startsWith(QLatin1Char('-')))
+			excluded.append(category.mid(1));
+		else
+			included.append(category);
+	}
 
-	// Make viewport sizing more reliable in Qt6: ask DOM for scroll size.
-	updateViewportToContentThenMaybeCapture();
+	const QJsonObject config{ { "recordMode", "recordAsMuchAsPossible" },
+	                          { "includedCategories", included },
+	                          { "excludedCategories", excluded } };
+	mDevTools->send(QStringLiteral("Tracing.start"),
+	                QJsonObject{ { "transferMode", "ReportEvents" }, { "traceConfig", config } },
+	                [started](const QJsonObject&) { started(); });
 }
 
-void CutyCapt::updateViewportToContentThenMaybeCapture() {
-	// If the caller expects an alert trigger, we keep waiting.
-	if (!mPage->getAlertString().isEmpty())
+void CutyTrace::onEvent(const QString& method, const QJsonObject& params) {
+	if (!mFile.isOpen())
 		return;
 
-	const QString js = R"(
-		(function() {
-			const de = document.documentElement;
-			const body = document.body;
-			const w = Math.max(de ? de.scrollWidth : 0, body ? body.scrollWidth : 0, window.innerWidth || 0);
-			const h = Math.max(de ? de.scrollHeight : 0, body ? body.scrollHeight : 0, window.innerHeight || 0);
-			return { width: w, height: h };
-		})()
-	)";
-
-	mPage->page()->runJavaScript(js, [this](const QVariant& v) {
-		const auto m = v.toMap();
-		const int w = m.value("width").toInt();
-		const int h = m.value("height").toInt();
-
-		if (w > 0 && h > 0) {
-			mViewSize = QSize(w, h);
-			mPage->setMinimumSize(mViewSize);
-			mPage->resize(mViewSize);
-			mSawGeometryChange = true;
-		} else {
-			// Fall back to current widget size if DOM size is not available yet.
-			mViewSize = mPage->size();
-			mSawGeometryChange = !mViewSize.isEmpty();
+	if (method == QLatin1String("Tracing.dataCollected")) {
+		for (const QJsonValue& event : params.value("value").toArray()) {
+			if (mEvents++ > 0)
+				mFile.write(",\n");
+			mFile.write(QJsonDocument(event.toObject()).toJson(QJsonDocument::Compact));
 		}
-
-		if (mSawDocumentComplete && mSawGeometryChange)
-			TryDelayedRender();
-	});
+	} else if (method == QLatin1String("Tracing.tracingComplete")) {
+		close();
+	}
 }
 
-void CutyCapt::TryDelayedRender() {
-	if (!mPage->getAlertString().isEmpty())
-		return;
-
-	if (mDelay > 0) {
-		QTimer::singleShot(mDelay, this, SLOT(Delayed()));
+void CutyTrace::finish(const std::function<void()>& done) {
+	mDone = done;
+	if (!mFile.isOpen()) {
+		close();
 		return;
 	}
 
-	saveSnapshot();
+	// The buffer arrives as dataCollected events, then tracingComplete; a
+	// lost connection is only noticed by the timeout.
+	mDevTools->send(QStringLiteral("Tracing.end"));
+	QTimer::singleShot(10000, this, [this] {
+		if (mDone)
+			close();
+	});
 }
 
-void CutyCapt::Timeout() {
-	if (!mSilent)
-		std::clog << "Timeout reached" << std::endl;
+void CutyTrace::close() {
+	if (mFile.isOpen()) {
+		mFile.write("\n]}\n");
+		mFile.close();
+		CutyMetrics::set("trace.events", double(mEvents));
+	}
 
-	saveSnapshot();
+	const std::function<void()> done = std::exchange(mDone, nullptr);
+	if (done)
+		done();
 }
 
-void CutyCapt::Delayed() {
-	saveSnapshot();
-}
+////////////////////////////////////////////////////////////////////
+// Fonts (fontconfig restriction and cache prewarming)
+////////////////////////////////////////////////////////////////////
 
-void CutyCapt::onContentsSizeChanged(const QSizeF& size) {
-	// Still useful as an extra hint; but JS sizing is the primary approach now.
-	if (!mSilent) {
-		std::clog << "contentsSizeChanged (" << size.width() << ", " << size.height() << ")"
-		          << std::endl;
-	}
-	if (size.width() > 0 && size.height() > 0) {
-		mViewSize = size.toSize();
-		mSawGeometryChange = true;
+struct CutyFontOptions {
+	QStringList dirs;
+	QStringList families;
+	QString cacheDir;
+	bool prewarmOnly{ false };
+	bool silent{ false };
+
+	bool isSet() const {
+		return !dirs.isEmpty() || !families.isEmpty() || !cacheDir.isEmpty() || prewarmOnly;
 	}
+};
+
+// Options the pre-scans below act on before the page exists must be spelled
+// out in full in main() as well; an abbreviation would be honoured by one
+// parser and missed by the other.
+static bool CaptExactOption(const char* name, const char* s, size_t nlen) {
+	return nlen == strlen(name) && strncmp(name, s, nlen) == 0;
 }
 
-void CutyCapt::pdfPrintFinish(const QString& file, bool success) {
-	if (!success && !mSilent) {
-		std::cerr << "Failed to print page to PDF '" << file.toStdString() << "'" << std::endl;
-		QApplication::exit(1);
-		return;
+// QApplication and Chromium's zygote read FONTCONFIG_FILE as soon as they
+// start, so the font options are picked out of argv ahead of both.
+static void CaptFontArgs(int argc, char* argv[], CutyFontOptions& fonts) {
+	for (int ax = 1; ax < argc; ++ax) {
+		const char* s = argv[ax];
+
+		if (strcmp("--silent", s) == 0) {
+			fonts.silent = true;
+			continue;
+		} else if (strcmp("--font-prewarm", s) == 0) {
+			fonts.prewarmOnly = true;
+			continue;
+		}
+
+		const char* value = strchr(s, '=');
+		if (!value)
+			continue;
+
+		size_t nlen = size_t(value++ - s);
+
+		if (CaptExactOption("--font-dir", s, nlen)) {
+			fonts.dirs << QFileInfo(QString::fromLocal8Bit(value)).absoluteFilePath();
+		} else if (CaptExactOption("--font-set", s, nlen)) {
+			for (const QString& family : QString::fromLocal8Bit(value).split(',', Qt::SkipEmptyParts))
+				fonts.families << family.trimmed();
+		} else if (CaptExactOption("--font-cache", s, nlen)) {
+			fonts.cacheDir = QFileInfo(QString::fromLocal8Bit(value)).absoluteFilePath();
+		}
 	}
-	QApplication::quit();
 }
 
-void CutyCapt::saveSnapshot() {
-	QPainter painter;
-	const char* format = nullptr;
+static QByteArray CaptFontConfig(const CutyFontOptions& fonts, const QString& cacheDir) {
+	QString xml;
+	QTextStream s(&xml);
 
-	for (int ix = 0; CutyExtMap[ix].id != OtherFormat; ++ix) {
-		if (CutyExtMap[ix].id == mFormat) {
-			format = CutyExtMap[ix].identifier;
-			break;
+	s << "<?xml version=\"1.0\"?>\n"
+	  << "<!DOCTYPE fontconfig SYSTEM \"urn:fontconfig:fonts.dtd\">\n"
+	  << "<fontconfig>\n"
+	  << "  <cachedir>" << cacheDir.toHtmlEscaped() << "</cachedir>\n";
+
+	// Without explicit directories, narrow the system configuration instead.
+	if (fonts.dirs.isEmpty())
+		s << "  <include ignore_missing=\"yes\">/etc/fonts/fonts.conf</include>\n";
+	for (const QString& dir : fonts.dirs)
+		s << "  <dir>" << dir.toHtmlEscaped() << "</dir>\n";
+
+	// acceptfont wins over rejectfont, so only the listed families survive.
+	if (!fonts.families.isEmpty()) {
+		s << "  <selectfont>\n"
+		  << "    <rejectfont><glob>*</glob></rejectfont>\n"
+		  << "    <acceptfont>\n";
+		for (const QString& family : fonts.families) {
+			s << "      <pattern><patelt name=\"family\"><string>" << family.toHtmlEscaped()
+			  << "</string></patelt></pattern>\n";
 		}
+		s << "    </acceptfont>\n"
+		  << "  </selectfont>\n";
 	}
 
-	QString out = mOutput;
-	mTimeoutTimer.stop();
+	// Workers never rescan; the cache is rebuilt by --font-prewarm instead.
+	s << "  <config><rescan><int>0</int></rescan></config>\n"
+	  << "</fontconfig>\n";
+	s.flush();
 
-	// Make sure we have some non-zero size.
-	if (mViewSize.isEmpty())
-		mViewSize = mPage->size();
-	if (mViewSize.isEmpty())
-		mViewSize = QSize(800, 600);
+	return xml.toUtf8();
+}
 
-	switch (mFormat) {
-		case SvgFormat: {
-			QSvgGenerator svg;
-			svg.setFileName(out);
-			svg.setSize(mViewSize);
-			painter.begin(&svg);
-			mPage->render(&painter);
-			painter.end();
-			QApplication::quit();
-			break;
-		}
-		case PdfFormat:
-		case PsFormat: {
-			// Qt6: async; observe QWebEnginePage::pdfPrintingFinished.
-			mPage->page()->printToPdf(out);
-			break;
-		}
-		case InnerTextFormat: {
-			mPage->page()->toPlainText([out](const QString& result) {
-				QFile file(out);
-				if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-					QTextStream s(&file);
-					s.setEncoding(QStringConverter::Utf8);
-					s << result;
-				}
-				QApplication::quit();
-			});
-			break;
-		}
-		case HtmlFormat: {
-			mPage->page()->toHtml([out](const QString& result) {
-				QFile file(out);
-				if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-					QTextStream s(&file);
-					s.setEncoding(QStringConverter::Utf8);
-					s << result;
-				}
-				QApplication::quit();
-			});
-			break;
+static bool CaptFontSetup(const CutyFontOptions& fonts) {
+	QElapsedTimer clock;
+	clock.start();
+
+	QString cacheDir = fonts.cacheDir;
+	if (cacheDir.isEmpty()) {
+		// Workers with the same font selection share one cache per host.
+		const QByteArray key = (fonts.dirs + QStringList{ "|" } + fonts.families).join('\n').toUtf8();
+		const QByteArray hash = QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex().left(12);
+		cacheDir = QDir::temp().filePath(QStringLiteral("cutycapt-fonts-") + QString::fromLatin1(hash));
+	}
+	QDir().mkpath(cacheDir);
+
+	const QString confPath = QDir(cacheDir).filePath(QStringLiteral("fonts.conf"));
+	const QByteArray conf = CaptFontConfig(fonts, cacheDir);
+
+	// A prewarmed cache directory may be read-only; only rewrite on change.
+	QFile current(confPath);
+	if (!current.open(QIODevice::ReadOnly) || current.readAll() != conf) {
+		current.close();
+		QSaveFile file(confPath);
+		if (!file.open(QIODevice::WriteOnly) || file.write(conf) != conf.size() || !file.commit()) {
+			std::cerr << "Unable to write font configuration '" << confPath.toStdString() << "'"
+			          << std::endl;
+			return false;
 		}
-		default: {
-			// Prefer grab() for QWidget-backed rendering.
-			// (render() can sometimes race WebEngine painting depending on platform)
-			QPixmap px = mPage->grab();
-
-			// If grab fails for any reason, fall back to render into QImage.
-			if (px.isNull()) {
-				QImage image(mViewSize, QImage::Format_ARGB32);
-				image.fill(Qt::transparent);
-				painter.begin(&image);
-				if (mSmooth) {
-					painter.setRenderHint(QPainter::SmoothPixmapTransform);
-					painter.setRenderHint(QPainter::Antialiasing);
-					painter.setRenderHint(QPainter::TextAntialiasing);
-				}
-				mPage->render(&painter);
-				painter.end();
-				image.save(out, format);
-			} else {
-				px.save(out, format);
-			}
+	}
+
+	qputenv("FONTCONFIG_FILE", QFile::encodeName(confPath));
+
+	const bool warm =
+		!QDir(cacheDir).entryList(QStringList{ QStringLiteral("*.cache-*") }, QDir::Files).isEmpty();
+	CutyMetrics::set("fonts.cache_hit", warm);
 
-			QApplication::quit();
+#if CUTYCAPT_FONTCONFIG
+	if (!warm || fonts.prewarmOnly) {
+		QElapsedTimer build;
+		build.start();
+
+		// Scanning the configured directories writes their caches to <cachedir>.
+		const QByteArray path = QFile::encodeName(confPath);
+		FcConfig* config = FcConfigCreate();
+		const bool ok = config &&
+		                FcConfigParseAndLoad(config, reinterpret_cast<const FcChar8*>(path.constData()),
+		                                     FcTrue) &&
+		                FcConfigBuildFonts(config);
+		if (config)
+			FcConfigDestroy(config);
+
+		CutyMetrics::set("fonts.prewarm_ms", build.elapsed());
+		if (!fonts.silent)
+			std::clog << "Font cache built in " << build.elapsed() << " ms" << std::endl;
+
+		if (!ok) {
+			std::cerr << "Unable to build font cache in '" << cacheDir.toStdString() << "'"
+			          << std::endl;
+			return false;
 		}
 	}
+#else
+	if (fonts.prewarmOnly) {
+		std::cerr << "--font-prewarm requires a build with fontconfig support" << std::endl;
+		return false;
+	}
+#endif
+
+	CutyMetrics::set("fonts.setup_ms", clock.elapsed());
+	return true;
 }
 
 ////////////////////////////////////////////////////////////////////
 // CLI / main
 ////////////////////////////////////////////////////////////////////
 
+// Options served through the DevTools protocol need Chromium's remote
+// debugging endpoint, which is configured from the environment before the
+// first page exists. Returns its port, or 0 when nothing needs it.
+static quint16 CaptDevToolsSetup(int argc, char* argv[]) {
+	bool needed = false;
+	QByteArray portArg;
+	for (int ax = 1; ax < argc; ++ax) {
+		if (strncmp("--warc=", argv[ax], 7) == 0 || strncmp("--chromium-trace=", argv[ax], 17) == 0 ||
+		    strcmp("--backend=devtools", argv[ax]) == 0)
+			needed = true;
+		else if (strncmp("--remote-debugging-port=", argv[ax], 24) == 0)
+			portArg = QByteArray(argv[ax] + 24);
+	}
+	if (!portArg.isEmpty()) {
+		qputenv("QTWEBENGINE_REMOTE_DEBUGGING", "127.0.0.1:" + portArg);
+		return quint16(portArg.toUInt());
+	}
+	if (!needed)
+		return 0;
+
+	const QByteArray configured = qgetenv("QTWEBENGINE_REMOTE_DEBUGGING");
+	if (!configured.isEmpty())
+		return quint16(configured.mid(configured.lastIndexOf(':') + 1).toUInt());
+
+	// Loopback only, on a port nobody else is using right now.
+	QTcpServer probe;
+	if (!probe.listen(QHostAddress::LocalHost, 0))
+		return 0;
+	const quint16 port = probe.serverPort();
+	probe.close();
+
+	qputenv("QTWEBENGINE_REMOTE_DEBUGGING", "127.0.0.1:" + QByteArray::number(port));
+	return port;
+}
+
+// "<ms>[:fail|capture|retry]" of a --*-timeout option.
+static bool CaptPhaseArg(const char* value, int& ms, CutyCapt::PhasePolicy& policy) {
+	char* rest = nullptr;
+	ms = int(strtol(value, &rest, 10));
+	if (*rest == '\0')
+		return true;
+	if (strcmp(rest, ":fail") == 0)
+		policy = CutyCapt::FailPolicy;
+	else if (strcmp(rest, ":capture") == 0)
+		policy = CutyCapt::CapturePolicy;
+	else if (strcmp(rest, ":retry") == 0)
+		policy = CutyCapt::RetryPolicy;
+	else
+		return false;
+	return true;
+}
+
 static void CaptHelp(const char* argv0) {
 	const QString prog = QFileInfo(QString::fromLocal8Bit(argv0)).fileName();
 
@@ -469,10 +4268,24 @@ static void CaptHelp(const char* argv0) {
 	       "  --help                             Print this help page and exit                 \n"
 	       "  --url=<url>                        The URL to capture (http:...|file:...|...)    \n"
 	       "  --out=<path>                       The target file (.png|pdf|svg|jpeg|...)       \n"
+	       "  --url-b=<url>                      Also load this URL, write <out>-b and -diff   \n"
+	       "  --diff-tolerance=<int>             Per-channel slack for --url-b (default: 0)    \n"
 	       "  --out-format=<f>                   Like extension in --out, overrides heuristic  \n"
 	       "  --min-width=<int>                  Minimal width for the image (default: 800)    \n"
 	       "  --min-height=<int>                 Minimal height for the image (default: 600)   \n"
+	       "  --full-page=<on|off>               Grow to the page size (off: viewport only)    \n"
+	       "  --max-height=<int>                 Maximal height for the image (default: none)  \n"
+	       "  --sizing-passes=<int>              Re-measure after resizing (default: 4)        \n"
 	       "  --max-wait=<ms>                    Don't wait more than (default: 90000, inf: 0) \n"
+	       "  --ttfb-timeout=<ms>[:<policy>]     Budget until the response starts (exit code 3)\n"
+	       "  --dcl-timeout=<ms>[:<policy>]      Then until DOMContentLoaded (exit code 4)     \n"
+	       "  --load-timeout=<ms>[:<policy>]     Then until the load event (exit code 5)       \n"
+	       "  --ready-timeout=<ms>[:<policy>]    Then until capture starts (exit code 6)       \n"
+	       "                                     policy: fail (default), capture, retry; ready \n"
+	       "                                     defaults to capture                           \n"
+	       "  --retries=<int>                    Reloads for the retry policy (default: 1)     \n"
+	       "  --max-cpu-ms=<ms>[:capture|fail]   Renderer CPU budget; fail exits with code 7   \n"
+	       "  --wait-until=<event>               load|domcontentloaded|fcp|lcp (default: load) \n"
 	       "  --delay=<ms>                       After successful load, wait (default: 0)      \n"
 	       "  --header=<name>:<value>            request header; repeatable; some can't be set \n"
 	       "  --body-string=<string>             Unencoded request body (default: none)        \n"
@@ -487,9 +4300,48 @@ static void CaptHelp(const char* argv0) {
 	       "  --js-can-access-clipboard=<on|off> Script clipboard privs (default: unknown)     \n"
 	       "  --print-backgrounds=<on|off>       Backgrounds in PDF output (default: off)      \n"
 	       "  --zoom-factor=<float>              Page zoom factor (default: no zooming)        \n"
+	       "  --autotrim[=<tol>]                 Crop uniform margins; <tol> per channel (0)   \n"
+	       "  --color=<mode>                     rgb, gray or bilevel[:<0-255>|otsu|adaptive]  \n"
+	       "  --quantize=<colors>                Palette output (PNG8/GIF) with up to <colors> \n"
+	       "  --dither                           Floyd-Steinberg dithering when quantizing     \n"
+	       "  --jpeg-quality=<0-100>             JPEG quality (default: 75)                    \n"
+	       "  --jpeg-subsampling=<444|422|420>   JPEG chroma subsampling (default: 420)        \n"
+	       "  --jpeg-progressive                 Write progressive JPEG                        \n"
+	       "  --jpeg-optimize                    Optimize JPEG Huffman tables                  \n"
+	       "  --clip=<x,y,w,h>                   Write this region to <out>-<n>; repeatable    \n"
+	       "  --clip-selector=<css>              Also one output per matching element          \n"
+	       "  --contact-sheet=<path>             Add a thumbnail to <path>-<n>.png sheets      \n"
+	       "  --contact-grid=<cols>x<rows>       Thumbnails per sheet (default: 6x8)           \n"
+	       "  --contact-thumb=<int>              Thumbnail width (default: 240)                \n"
+	       "  --backend=<widget|devtools>        Screenshot by growing the widget (default) or \n"
+	       "                                     via DevTools Page.captureScreenshot           \n"
+	       "  --scale=<float>                    Device scale of devtools screenshots          \n"
+	       "  --remote-debugging-port=<int>      Loopback DevTools port (default: any free)    \n"
+	       "  --chromium-trace=<path>            Write a Chromium trace of the capture (JSON)  \n"
+	       "  --trace-categories=<list>          Comma-separated; -name excludes a category    \n"
+	       "  --warc=<path>                      Also record the load as WARC (.warc[.gz])     \n"
+	       "  --warc-index=<path>                Digest index shared for revisit records       \n"
+	       "  --frames=<all|css>                 Also capture child frames to <out>-frame-<n>  \n"
+	       "  --frame-content=<html|text>        Also save each captured frame's document      \n"
+	       "  --preview=<path>                   Early viewport capture at first paint         \n"
+	       "  --preview-width=<int>              Width of the preview image (default: 480)     \n"
+	       "  --phash                            Write a perceptual hash to <out>.phash        \n"
+	       "  --phash-index=<path>               Shared hash index; flags near-duplicates      \n"
+	       "  --phash-distance=<bits>            Near-duplicate Hamming distance (default: 8)  \n"
+	       "  --skip-duplicates                  Don't write captures flagged as near-duplicate\n"
+	       "  --recompress                       Fast PNG now, idle-priority optimal rewrite   \n"
 	       "  --smooth                           Enable higher-quality painter hints           \n"
+	       "  --svg-tiles=<png|webp|jpeg|off>    SVG as compressed tiles (default: off)        \n"
+	       "  --svg-tile-size=<int>              Tile edge in pixels (default: 512)            \n"
+	       "  --svg-text                         Overlay selectable DOM text on SVG tiles      \n"
+	       "  --render-profile=<default|compact> compact: gray AA text, opaque RGB, no dither  \n"
 	       "  --insecure                         Ignore SSL/TLS certificate errors (overridable)\n"
 	       "  --silent                           Less console output                           \n"
+	       "  --metrics=<path>                   Write run timings as JSON ('-' for stdout)    \n"
+	       "  --font-dir=<path>                  Only use fonts below <path>; repeatable       \n"
+	       "  --font-set=<family,...>            Only use these font families                  \n"
+	       "  --font-cache=<path>                Shared fontconfig cache (default: temp dir)   \n"
+	       "  --font-prewarm                     Build the font cache and exit                 \n"
 #if CUTYCAPT_SCRIPT
 	       "  --inject-script=<path>             JavaScript injected at DocumentReady           \n"
 	       "  --script-object=<string>           window[<string>] becomes the WebChannel bridge\n"
@@ -497,22 +4349,97 @@ static void CaptHelp(const char* argv0) {
 	       "  --debug-print-alerts               Print JS alert(...) strings                    \n"
 #endif
 	       " ----------------------------------------------------------------------------------\n"
-	       "  <f> is svg,pdf,ps,itext,html,png,jpeg,mng,tiff,gif,bmp,ppm,xbm,xpm               \n"
+	       "  <f> is svg,pdf,ps,itext,html,png,jpeg,mng,tiff,gif,bmp,ppm,xbm,xpm,webp,auto     \n"
+	       "  auto picks png, png8, webp or jpeg from the captured image and replaces the      \n"
+	       "  file extension of --out accordingly                                              \n"
 	       " ----------------------------------------------------------------------------------\n");
 }
 
 int main(int argc, char* argv[]) {
+	CutyMetrics::start();
+
+	// Detached recompression worker spawned by --recompress.
+	for (int ax = 1; ax < argc; ++ax) {
+		if (strncmp("--recompress-png=", argv[ax], 17) != 0)
+			continue;
+#if CUTYCAPT_ZLIB
+		const bool silent = ax + 1 < argc && strcmp(argv[ax + 1], "--silent") == 0;
+		return CaptRecompressPng(QString::fromLocal8Bit(argv[ax] + 17), silent);
+#else
+		return EXIT_FAILURE;
+#endif
+	}
+
+	CutyFontOptions fonts;
+	CaptFontArgs(argc, argv, fonts);
+	if (fonts.isSet() && !CaptFontSetup(fonts))
+		return EXIT_FAILURE;
+	if (fonts.prewarmOnly)
+		return EXIT_SUCCESS;
+
 	bool argHelp = false;
 	int argDelay = 0;
 	bool argSilent = false;
 	bool argInsecure = false;
 	int32_t argMinWidth = 800;
 	int32_t argMinHeight = 600;
+	int32_t argMaxHeight = 0;
+	int32_t argSizingPasses = 4;
+	bool argFullPage = true;
+	int argAutotrim = -1;
+	int argQuantize = 0;
+	CutyCapt::ColorMode argColorMode = CutyCapt::RgbColor;
+	int argThreshold = CutyCapt::OtsuThreshold;
+	bool argDither = false;
+	bool argRecompress = false;
+	QList<QRect> argClips;
+	QStringList argClipSelectors;
+	QString argContactSheet;
+	int argContactColumns = 6;
+	int argContactRows = 8;
+	int argContactThumb = 240;
+	const char* argUrlB = nullptr;
+	int argDiffTolerance = 0;
+	QString argWaitUntil;
+	int argPhaseBudget[CutyCapt::PhaseCount] = {};
+	CutyCapt::PhasePolicy argPhasePolicy[CutyCapt::PhaseCount] = {
+		CutyCapt::FailPolicy, CutyCapt::FailPolicy, CutyCapt::FailPolicy, CutyCapt::CapturePolicy
+	};
+	int argRetries = 1;
+	int argCpuBudget = 0;
+	CutyCapt::PhasePolicy argCpuPolicy = CutyCapt::CapturePolicy;
+	bool argDevToolsBackend = false;
+	double argScale = 1.0;
+	CutyCapt::RenderProfile argRenderProfile = CutyCapt::DefaultRender;
+	QString argSvgTiles;
+	int argSvgTileSize = 512;
+	bool argSvgText = false;
+	QString argTrace;
+	QStringList argTraceCategories{
+		"devtools.timeline", "disabled-by-default-devtools.timeline",
+		"disabled-by-default-devtools.timeline.frame", "toplevel", "blink", "blink.user_timing",
+		"loading", "v8.execute", "cc", "gpu", "viz",
+	};
+	QString argWarc;
+	QString argWarcIndex;
+	QString argFrames;
+	QString argFrameContent;
+	QString argPreview;
+	int argPreviewWidth = 480;
+	bool argPhash = false;
+	QString argPhashIndex;
+	int argPhashDistance = 8;
+	bool argSkipDuplicates = false;
+	int argJpegQuality = 75;
+	int argJpegSubsampling = 420;
+	bool argJpegProgressive = false;
+	bool argJpegOptimize = false;
 	uint32_t argMaxWait = 90000;
 	bool argSmooth = false;
 
 	const char* argUrl = nullptr;
 	QString argOut;
+	QString argMetrics;
 
 #if CUTYCAPT_SCRIPT
 	const char* argInjectScript = nullptr;
@@ -522,6 +4449,18 @@ int main(int argc, char* argv[]) {
 	CutyCapt::OutputFormat format = CutyCapt::OtherFormat;
 
 	QApplication app(argc, argv);
+	CutyMetrics::mark("startup.application_ms");
+
+	const quint16 devToolsPort = CaptDevToolsSetup(argc, argv);
+
+	// Chromium takes its switches from the environment when the first page
+	// is created; LCD text would put colour fringes into every glyph.
+	for (int ax = 1; ax < argc; ++ax) {
+		if (strcmp("--render-profile=compact", argv[ax]) == 0) {
+			const QByteArray flags = qgetenv("QTWEBENGINE_CHROMIUM_FLAGS");
+			qputenv("QTWEBENGINE_CHROMIUM_FLAGS", (flags + " --disable-lcd-text").trimmed());
+		}
+	}
 
 	CutyPage page;
 
@@ -544,6 +4483,34 @@ int main(int argc, char* argv[]) {
 		} else if (strcmp("--smooth", s) == 0) {
 			argSmooth = true;
 			continue;
+		} else if (strcmp("--autotrim", s) == 0) {
+			argAutotrim = 0;
+			continue;
+		} else if (strcmp("--dither", s) == 0) {
+			argDither = true;
+			continue;
+		} else if (strcmp("--svg-text", s) == 0) {
+			argSvgText = true;
+			continue;
+		} else if (strcmp("--phash", s) == 0) {
+			argPhash = true;
+			continue;
+		} else if (strcmp("--skip-duplicates", s) == 0) {
+			argSkipDuplicates = true;
+			continue;
+		} else if (strcmp("--recompress", s) == 0) {
+#if CUTYCAPT_ZLIB
+			argRecompress = true;
+#else
+			std::cerr << "--recompress requires a build with zlib" << std::endl;
+#endif
+			continue;
+		} else if (strcmp("--jpeg-progressive", s) == 0) {
+			argJpegProgressive = true;
+			continue;
+		} else if (strcmp("--jpeg-optimize", s) == 0) {
+			argJpegOptimize = true;
+			continue;
 #if CUTYCAPT_SCRIPT
 		} else if (strcmp("--debug-print-alerts", s) == 0) {
 			page.setPrintAlerts(true);
@@ -561,10 +4528,165 @@ int main(int argc, char* argv[]) {
 
 		if (strncmp("--url", s, nlen) == 0) {
 			argUrl = value;
+		} else if (strncmp("--ttfb-timeout", s, nlen) == 0) {
+			const int phase = CutyCapt::FirstBytePhase;
+			if (!CaptPhaseArg(value, argPhaseBudget[phase], argPhasePolicy[phase])) {
+				argHelp = true;
+				break;
+			}
+		} else if (strncmp("--dcl-timeout", s, nlen) == 0) {
+			const int phase = CutyCapt::DomContentPhase;
+			if (!CaptPhaseArg(value, argPhaseBudget[phase], argPhasePolicy[phase])) {
+				argHelp = true;
+				break;
+			}
+		} else if (strncmp("--load-timeout", s, nlen) == 0) {
+			const int phase = CutyCapt::LoadPhase;
+			if (!CaptPhaseArg(value, argPhaseBudget[phase], argPhasePolicy[phase])) {
+				argHelp = true;
+				break;
+			}
+		} else if (strncmp("--ready-timeout", s, nlen) == 0) {
+			const int phase = CutyCapt::ReadyPhase;
+			if (!CaptPhaseArg(value, argPhaseBudget[phase], argPhasePolicy[phase])) {
+				argHelp = true;
+				break;
+			}
+		} else if (strncmp("--max-cpu-ms", s, nlen) == 0) {
+			if (!CaptPhaseArg(value, argCpuBudget, argCpuPolicy) ||
+			    argCpuPolicy == CutyCapt::RetryPolicy) {
+				argHelp = true;
+				break;
+			}
+		} else if (strncmp("--retries", s, nlen) == 0) {
+			argRetries = strtol(value, nullptr, 0);
+		} else if (strncmp("--url-b", s, nlen) == 0) {
+			argUrlB = value;
+		} else if (strncmp("--diff-tolerance", s, nlen) == 0) {
+			argDiffTolerance = qBound(0, int(strtol(value, nullptr, 0)), 255);
+		} else if (strncmp("--wait-until", s, nlen) == 0) {
+			if (strcmp(value, "load") != 0 && strcmp(value, "domcontentloaded") != 0 &&
+			    strcmp(value, "fcp") != 0 && strcmp(value, "lcp") != 0) {
+				argHelp = true;
+				break;
+			}
+			if (strcmp(value, "load") != 0)
+				argWaitUntil = QString::fromUtf8(value);
 		} else if (strncmp("--min-width", s, nlen) == 0) {
 			argMinWidth = strtol(value, nullptr, 0);
 		} else if (strncmp("--min-height", s, nlen) == 0) {
 			argMinHeight = strtol(value, nullptr, 0);
+		} else if (strncmp("--max-height", s, nlen) == 0) {
+			argMaxHeight = strtol(value, nullptr, 0);
+		} else if (strncmp("--full-page", s, nlen) == 0) {
+			if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+				argHelp = true;
+				break;
+			}
+			argFullPage = strcmp(value, "on") == 0;
+		} else if (strncmp("--sizing-passes", s, nlen) == 0) {
+			argSizingPasses = strtol(value, nullptr, 0);
+		} else if (strncmp("--autotrim", s, nlen) == 0) {
+			argAutotrim = strtol(value, nullptr, 0);
+		} else if (strncmp("--color", s, nlen) == 0) {
+			const char* threshold = strchr(value, ':');
+			const QByteArray mode = threshold ? QByteArray(value, int(threshold++ - value)) : QByteArray(value);
+			if (mode == "rgb") {
+				argColorMode = CutyCapt::RgbColor;
+			} else if (mode == "gray") {
+				argColorMode = CutyCapt::GrayColor;
+			} else if (mode == "bilevel") {
+				argColorMode = CutyCapt::BilevelColor;
+			} else {
+				argHelp = true;
+				break;
+			}
+			if (threshold && strcmp(threshold, "adaptive") == 0)
+				argThreshold = CutyCapt::AdaptiveThreshold;
+			else if (threshold && strcmp(threshold, "otsu") != 0)
+				argThreshold = qBound(0, int(strtol(threshold, nullptr, 0)), 255);
+		} else if (strncmp("--jpeg-quality", s, nlen) == 0) {
+			argJpegQuality = strtol(value, nullptr, 0);
+		} else if (strncmp("--jpeg-subsampling", s, nlen) == 0) {
+			argJpegSubsampling = strtol(value, nullptr, 10);
+			if (argJpegSubsampling != 444 && argJpegSubsampling != 422 && argJpegSubsampling != 420) {
+				argHelp = true;
+				break;
+			}
+		} else if (strncmp("--clip", s, nlen) == 0) {
+			const QStringList parts = QString::fromUtf8(value).split(QLatin1Char(','));
+			if (parts.size() != 4) {
+				argHelp = true;
+				break;
+			}
+			argClips.append(QRect(parts[0].toInt(), parts[1].toInt(), parts[2].toInt(),
+			                      parts[3].toInt()));
+		} else if (strncmp("--clip-selector", s, nlen) == 0) {
+			argClipSelectors.append(QString::fromUtf8(value));
+		} else if (strncmp("--contact-sheet", s, nlen) == 0) {
+			argContactSheet = QString::fromUtf8(value);
+		} else if (strncmp("--contact-grid", s, nlen) == 0) {
+			char* rows = nullptr;
+			argContactColumns = strtol(value, &rows, 10);
+			if (*rows != 'x') {
+				argHelp = true;
+				break;
+			}
+			argContactRows = strtol(rows + 1, nullptr, 10);
+		} else if (strncmp("--contact-thumb", s, nlen) == 0) {
+			argContactThumb = strtol(value, nullptr, 0);
+		} else if (CaptExactOption("--backend", s, nlen)) {
+			if (strcmp(value, "widget") != 0 && strcmp(value, "devtools") != 0) {
+				argHelp = true;
+				break;
+			}
+			argDevToolsBackend = strcmp(value, "devtools") == 0;
+		} else if (strncmp("--scale", s, nlen) == 0) {
+			argScale = QString::fromUtf8(value).toDouble();
+		} else if (CaptExactOption("--remote-debugging-port", s, nlen)) {
+			// Applied by CaptDevToolsSetup() before the page was created.
+		} else if (strncmp("--svg-tiles", s, nlen) == 0) {
+			if (strcmp(value, "png") != 0 && strcmp(value, "webp") != 0 && strcmp(value, "jpeg") != 0 &&
+			    strcmp(value, "off") != 0) {
+				argHelp = true;
+				break;
+			}
+			argSvgTiles = strcmp(value, "off") == 0 ? QString() : QString::fromUtf8(value);
+		} else if (strncmp("--svg-tile-size", s, nlen) == 0) {
+			argSvgTileSize = strtol(value, nullptr, 0);
+		} else if (CaptExactOption("--render-profile", s, nlen)) {
+			if (strcmp(value, "default") != 0 && strcmp(value, "compact") != 0) {
+				argHelp = true;
+				break;
+			}
+			if (strcmp(value, "compact") == 0)
+				argRenderProfile = CutyCapt::CompactRender;
+		} else if (CaptExactOption("--chromium-trace", s, nlen)) {
+			argTrace = QString::fromUtf8(value);
+		} else if (CaptExactOption("--trace-categories", s, nlen)) {
+			argTraceCategories = QString::fromUtf8(value).split(QLatin1Char(','), Qt::SkipEmptyParts);
+		} else if (CaptExactOption("--warc", s, nlen)) {
+			argWarc = QString::fromUtf8(value);
+		} else if (CaptExactOption("--warc-index", s, nlen)) {
+			argWarcIndex = QString::fromUtf8(value);
+		} else if (strncmp("--frames", s, nlen) == 0) {
+			argFrames = QString::fromUtf8(value);
+		} else if (strncmp("--frame-content", s, nlen) == 0) {
+			if (strcmp(value, "html") != 0 && strcmp(value, "text") != 0) {
+				argHelp = true;
+				break;
+			}
+			argFrameContent = QString::fromUtf8(value);
+		} else if (strncmp("--preview", s, nlen) == 0) {
+			argPreview = value;
+		} else if (strncmp("--preview-width", s, nlen) == 0) {
+			argPreviewWidth = strtol(value, nullptr, 0);
+		} else if (strncmp("--phash-index", s, nlen) == 0) {
+			argPhashIndex = value;
+		} else if (strncmp("--phash-distance", s, nlen) == 0) {
+			argPhashDistance = strtol(value, nullptr, 0);
+		} else if (strncmp("--quantize", s, nlen) == 0) {
+			argQuantize = strtol(value, nullptr, 0);
 		} else if (strncmp("--delay", s, nlen) == 0) {
 			argDelay = strtol(value, nullptr, 0);
 		} else if (strncmp("--max-wait", s, nlen) == 0) {
@@ -610,6 +4732,11 @@ int main(int argc, char* argv[]) {
 				argHelp = true;
 				break;
 			}
+		} else if (strncmp("--metrics", s, nlen) == 0) {
+			argMetrics = value;
+		} else if (CaptExactOption("--font-dir", s, nlen) || CaptExactOption("--font-set", s, nlen) ||
+		           CaptExactOption("--font-cache", s, nlen)) {
+			// Applied by CaptFontSetup() before QApplication was created.
 		} else if (strncmp("--header", s, nlen) == 0) {
 			const char* hv = strchr(value, ':');
 			if (!hv) {
@@ -635,6 +4762,11 @@ int main(int argc, char* argv[]) {
 		return EXIT_FAILURE;
 	}
 
+	if (argUrlB && format < CutyCapt::PngFormat && format != CutyCapt::OtherFormat) {
+		std::cerr << "--url-b needs a raster output format" << std::endl;
+		return EXIT_FAILURE;
+	}
+
 	req.setUrl(QUrl::fromEncoded(argUrl));
 
 	if (!body.isNull())
@@ -662,35 +4794,161 @@ int main(int argc, char* argv[]) {
 	QString scriptCode;
 #endif
 
+	// Options that shape the image, shared by both pages of a comparison.
+	const auto configure = [&](CutyCapt& capt) {
+		capt.setWaitUntil(argWaitUntil);
+		capt.setCpuBudget(argCpuBudget, argCpuPolicy);
+		for (int phase = 0; phase < CutyCapt::PhaseCount; ++phase) {
+			capt.setPhaseTimeout(CutyCapt::Phase(phase), argPhaseBudget[phase],
+			                     argPhasePolicy[phase]);
+		}
+		capt.setFullPage(argFullPage);
+		capt.setMaxHeight(argMaxHeight);
+		capt.setSizingPasses(argSizingPasses);
+		capt.setAutotrim(argAutotrim);
+		capt.setColorMode(argColorMode, argThreshold);
+		capt.setQuantize(argQuantize, argDither);
+		capt.setRenderProfile(argRenderProfile);
+		capt.setSvgTiles(argSvgTiles, argSvgTileSize, argSvgText);
+		capt.setContactSheet(argContactSheet, argContactColumns, argContactRows, argContactThumb);
+		capt.setRecompress(argRecompress);
+		capt.setPerceptualHash(argPhash, argPhashIndex, argPhashDistance, argSkipDuplicates);
+		capt.setJpegOptions(argJpegQuality, argJpegSubsampling, argJpegProgressive, argJpegOptimize);
+	};
+
+	if (argMaxHeight > 0 && argMinHeight > argMaxHeight)
+		argMinHeight = argMaxHeight;
+
+	const auto start = [&](CutyPage& view, CutyCapt& capt) {
+		QObject::connect(&view, &QWebEngineView::loadStarted, &capt, &CutyCapt::LoadStarted);
+		QObject::connect(&view, &QWebEngineView::loadFinished, &capt, &CutyCapt::DocumentComplete);
+		QObject::connect(view.page(), &QWebEnginePage::contentsSizeChanged, &capt,
+		                 &CutyCapt::onContentsSizeChanged);
+
+		// Qt6 docs: observe pdfPrintingFinished for printToPdf completion.
+		QObject::connect(view.page(), &QWebEnginePage::pdfPrintingFinished, &capt,
+		                 &CutyCapt::pdfPrintFinish);
+
+		if (argMaxWait > 0) {
+			QTimer& timer = capt.mTimeoutTimer;
+			timer.setInterval(int(argMaxWait));
+			timer.setSingleShot(true);
+			QObject::connect(&timer, &QTimer::timeout, &capt, &CutyCapt::Timeout);
+			timer.start();
+		}
+
+		view.setAttribute(QWebEngineSettings::WebAttribute::ShowScrollBars, "off");
+		view.setAttribute(Qt::WA_DontShowOnScreen, true);
+
+		QSize argSize(argMinWidth, argMinHeight);
+		view.setMinimumSize(argSize);
+		view.setMaximumSize(QSize(QWIDGETSIZE_MAX, QWIDGETSIZE_MAX));
+		view.resize(argSize);
+		view.show();
+	};
+
 	CutyCapt main(&page, argOut, argDelay, format, QString{}, QString{}, argInsecure, argSmooth,
 	              argSilent);
+	configure(main);
+	main.setRetries(argRetries, req);
+	main.setPreview(argPreview, argPreviewWidth);
+	main.setFrames(argFrames, argFrameContent);
+	for (const QRect& clip : argClips)
+		main.addClip(clip);
+	for (const QString& selector : argClipSelectors)
+		main.addClipSelector(selector);
+	start(page, main);
+
+	// --url-b: a second page with the same settings loads concurrently and
+	// writes <out>-b; CutyCompare quits once both are done.
+	std::unique_ptr<CutyPage> pageB;
+	std::unique_ptr<CutyCapt> mainB;
+	std::unique_ptr<CutyCompare> compare;
+	QWebEngineHttpRequest reqB(req);
+	if (argUrlB) {
+		reqB.setUrl(QUrl::fromEncoded(argUrlB));
+		pageB = std::make_unique<CutyPage>();
+		pageB->copySettings(page);
+#if CUTYCAPT_SCRIPT
+		pageB->installScriptSupport(scriptProp, scriptCode, argSilent);
+#endif
+		mainB = std::make_unique<CutyCapt>(pageB.get(), CaptSiblingPath(argOut, "b"), argDelay, format,
+		                                   QString{}, QString{}, argInsecure, argSmooth, argSilent);
+		configure(*mainB);
+		mainB->setRetries(argRetries, reqB);
+		mainB->setMetricsPrefix(QStringLiteral("b."));
+		start(*pageB, *mainB);
+		compare = std::make_unique<CutyCompare>(&main, mainB.get(),
+		                                        CaptSiblingPath(argOut, "diff", ".png"),
+		                                        argDiffTolerance, argSilent);
+	} else {
+		QObject::connect(&main, &CutyCapt::finished, &app, [](int code) { QApplication::exit(code); });
+	}
 
-	QObject::connect(&page, &QWebEngineView::loadFinished, &main, &CutyCapt::DocumentComplete);
-	QObject::connect(page.page(), &QWebEnginePage::contentsSizeChanged, &main,
-	                 &CutyCapt::onContentsSizeChanged);
+	const auto load = [&] {
+		CutyMetrics::mark("startup.ready_ms");
+		page.load(req);
+		if (pageB)
+			pageB->load(reqB);
+	};
 
-	// Qt6 docs: observe pdfPrintingFinished for printToPdf completion.
-	QObject::connect(page.page(), &QWebEnginePage::pdfPrintingFinished, &main,
-	                 &CutyCapt::pdfPrintFinish);
+	// DevTools-backed options share one connection to the main page, and
+	// nothing is loaded before it is settled: the recordings (--warc,
+	// --chromium-trace) must be running before navigating, and sizing
+	// depends on whether the screenshot backend is there. Without DevTools
+	// the capture goes ahead the usual way.
+	const bool wantDevTools = !argWarc.isEmpty() || !argTrace.isEmpty() || argDevToolsBackend;
+	std::unique_ptr<CutyDevTools> devTools;
+	std::unique_ptr<CutyWarc> warc;
+	std::unique_ptr<CutyTrace> trace;
+	bool devToolsSettled = false;
+	if (wantDevTools && devToolsPort) {
+		devTools = std::make_unique<CutyDevTools>(devToolsPort, page.page());
+		if (argDevToolsBackend)
+			main.setDevTools(devTools.get(), argScale);
+		if (!argWarc.isEmpty()) {
+			warc = std::make_unique<CutyWarc>(devTools.get(), argWarc, argWarcIndex, argSilent);
+			main.setWarc(warc.get());
+		}
+		if (!argTrace.isEmpty()) {
+			trace = std::make_unique<CutyTrace>(devTools.get(), argTrace, argTraceCategories, argSilent);
+			main.setTrace(trace.get());
+		}
 
-	if (argMaxWait > 0) {
-		QTimer& timer = main.mTimeoutTimer;
-		timer.setInterval(int(argMaxWait));
-		timer.setSingleShot(true);
-		QObject::connect(&timer, &QTimer::timeout, &main, &CutyCapt::Timeout);
-		timer.start();
+		QObject::connect(devTools.get(), &CutyDevTools::ready, &app, [&] {
+			if (std::exchange(devToolsSettled, true))
+				return;
+			std::function<void()> next = load;
+			if (trace)
+				next = [&trace, next] { trace->start(next); };
+			if (warc)
+				next = [&warc, next] { warc->start(next); };
+			next();
+		});
+		QObject::connect(devTools.get(), &CutyDevTools::failed, &app, [&](const QString& reason) {
+			if (std::exchange(devToolsSettled, true))
+				return;
+			if (!argSilent)
+				std::cerr << "DevTools unavailable: " << reason.toStdString() << std::endl;
+			main.setWarc(nullptr);
+			main.setTrace(nullptr);
+			main.setDevTools(nullptr, argScale);
+			load();
+		});
+		devTools->open();
+	} else {
+		if (wantDevTools && !argSilent)
+			std::cerr << "No remote debugging port available for DevTools" << std::endl;
+		load();
 	}
 
-	page.setAttribute(QWebEngineSettings::WebAttribute::ShowScrollBars, "off");
-	page.setAttribute(Qt::WA_DontShowOnScreen, true);
+	const int rc = app.exec();
 
-	QSize argSize(argMinWidth, argMinHeight);
-	page.setMinimumSize(argSize);
-	page.setMaximumSize(QSize(QWIDGETSIZE_MAX, QWIDGETSIZE_MAX));
-	page.resize(argSize);
-	page.show();
-
-	page.load(req);
+	if (!argMetrics.isEmpty()) {
+		CutyMetrics::heap("heap");
+		if (!CutyMetrics::save(argMetrics) && !argSilent)
+			std::cerr << "Failed to write metrics to '" << argMetrics.toStdString() << "'" << std::endl;
+	}
 
-	return app.exec();
+	return rc;
 }
\ No newline at end of file
@@ -1,13 +1,23 @@
 #pragma once
 
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QJsonObject>
 #include <QObject>
+#include <QRect>
 #include <QSize>
 #include <QString>
+#include <QTcpSocket>
 #include <QTimer>
+#include <QWebEngineHttpRequest>
 #include <QWebEngineView>
 #include <QWebEnginePage>
 #include <QWebEngineSettings>
 
+#include <functional>
+
 // Enable script injection / remote control
 #ifndef CUTYCAPT_SCRIPT
 #define CUTYCAPT_SCRIPT 1
@@ -18,7 +28,49 @@
 #include <QWebEngineScript>
 #endif
 
+// Restrict and prewarm fontconfig (requires libfontconfig)
+#ifndef CUTYCAPT_FONTCONFIG
+#define CUTYCAPT_FONTCONFIG 0
+#endif
+
+// Encode JPEG with libjpeg(-turbo) directly instead of Qt's image plugin
+#ifndef CUTYCAPT_LIBJPEG
+#define CUTYCAPT_LIBJPEG 0
+#endif
+
+// Exhaustive PNG recompression (requires zlib)
+#ifndef CUTYCAPT_ZLIB
+#define CUTYCAPT_ZLIB 0
+#endif
+
+// Replacement heap allocators (selected by CUTYCAPT_ALLOCATOR in CMake)
+#ifndef CUTYCAPT_JEMALLOC
+#define CUTYCAPT_JEMALLOC 0
+#endif
+#ifndef CUTYCAPT_MIMALLOC
+#define CUTYCAPT_MIMALLOC 0
+#endif
+
 class CutyCapt;
+class CutyDevTools;
+class CutyTrace;
+class CutyWarc;
+
+// Process-wide timings and counters, written as JSON by --metrics.
+class CutyMetrics {
+public:
+	static void start();
+	static void set(const QString& key, const QJsonValue& value);
+	// Record milliseconds elapsed since start() under key.
+	static void mark(const QString& key);
+	// Record allocator statistics (active, resident, fragmentation, arenas).
+	static void heap(const QString& prefix);
+	static bool save(const QString& path);
+
+private:
+	static QElapsedTimer sClock;
+	static QJsonObject sValues;
+};
 
 // Modern WebEngine hooks belong on QWebEnginePage, not QWebEngineView.
 class CutyEnginePage : public QWebEnginePage {
@@ -31,6 +83,8 @@ public:
 	QString getAlertString() const;
 	void setPrintAlerts(bool printAlerts);
 	void setCutyCapt(CutyCapt* cutyCapt);
+	// Console messages starting with prefix carry lifecycle events.
+	void setLifecyclePrefix(const QString& prefix);
 	void setInsecure(bool insecure);
 
 	// Qt6: handle TLS errors via signal rather than overriding a virtual
@@ -47,12 +101,17 @@ protected:
 	bool javaScriptPrompt(const QUrl& securityOrigin, const QString& msg, const QString& defaultValue,
 	                      QString* result) override;
 
+	// Lifecycle events reported by the injected observer script
+	void javaScriptConsoleMessage(JavaScriptConsoleMessageLevel level, const QString& message,
+	                              int lineNumber, const QString& sourceID) override;
+
 private:
 	QString mUserAgent;
 	QString mAlertString;
 	bool mPrintAlerts{ false };
 	bool mInsecure{ false };
 	CutyCapt* mCutyCapt{ nullptr };
+	QString mLifecyclePrefix;
 };
 
 #if CUTYCAPT_SCRIPT
@@ -88,6 +147,8 @@ public:
 	void setPrintAlerts(bool printAlerts);
 	void setCutyCapt(CutyCapt* cutyCapt);
 	void setInsecure(bool insecure);
+	// Web attributes, zoom and expected alert of other (for --url-b).
+	void copySettings(const CutyPage& other);
 
 #if CUTYCAPT_SCRIPT
 	// Script support
@@ -124,18 +185,120 @@ public:
 		PpmFormat,
 		XbmFormat,
 		XpmFormat,
+		WebpFormat,
+		AutoFormat,
 		OtherFormat
 	};
 
+	enum ColorMode {
+		RgbColor,
+		GrayColor,
+		BilevelColor
+	};
+
+	enum RenderProfile {
+		DefaultRender,
+		// Grayscale-antialiased text, no dithering, opaque RGB output.
+		CompactRender
+	};
+
+	// Bilevel thresholds below zero select automatic thresholding.
+	enum {
+		OtsuThreshold = -1,
+		AdaptiveThreshold = -2
+	};
+
+	// Load phases, each with its own --*-timeout budget and policy.
+	enum Phase {
+		FirstBytePhase,
+		DomContentPhase,
+		LoadPhase,
+		ReadyPhase,
+		PhaseCount
+	};
+
+	enum PhasePolicy {
+		FailPolicy,
+		CapturePolicy,
+		RetryPolicy
+	};
+
+	// A phase that fails exits with PhaseExitCode + phase.
+	enum {
+		PhaseExitCode = 3,
+		CpuExitCode = 7
+	};
+
 	CutyCapt(CutyPage* page, const QString& output, int delay, OutputFormat format,
 	         const QString& scriptProp, const QString& scriptCode, bool insecure, bool smooth,
 	         bool silent);
 
+	// When off, capture the initial viewport without growing the widget.
+	void setFullPage(bool fullPage);
+	// 0 disables the cap.
+	void setMaxHeight(int maxHeight);
+	// Resize/re-measure rounds before giving up on a stable content size.
+	void setSizingPasses(int passes);
+	// Crop uniform margins with this per-channel tolerance; -1 disables.
+	void setAutotrim(int tolerance);
+	// Convert raster output to 8-bit gray or 1-bit before encoding.
+	void setColorMode(ColorMode mode, int threshold);
+	// subsampling is 444, 422 or 420; only libjpeg builds honour it.
+	void setJpegOptions(int quality, int subsampling, bool progressive, bool optimize);
+	// Write PNGs fast, then rewrite them optimally in a detached idle worker.
+	void setRecompress(bool recompress);
+	// Perceptual hash sidecar and near-duplicate lookup in a shared index.
+	void setPerceptualHash(bool sidecar, const QString& index, int distance, bool skipDuplicates);
+	// 0 ms disables the budget of that phase.
+	void setPhaseTimeout(Phase phase, int ms, PhasePolicy policy);
+	// Reloads of request the retry policy may make.
+	void setRetries(int retries, const QWebEngineHttpRequest& request);
+	// Renderer CPU time after which scripts are stopped and the page is
+	// captured as is (CapturePolicy) or abandoned (FailPolicy). Linux only.
+	void setCpuBudget(int ms, PhasePolicy policy);
+	// Take screenshots with DevTools Page.captureScreenshot instead of
+	// growing and grabbing the widget; scale applies to those shots.
+	void setDevTools(CutyDevTools* devTools, double scale);
+	// Finish these recordings before reporting finished().
+	void setWarc(CutyWarc* warc);
+	void setTrace(CutyTrace* trace);
+	// Start capturing on a lifecycle event ("domcontentloaded", "fcp" or
+	// "lcp") instead of loadFinished; empty waits for the load event.
+	void setWaitUntil(const QString& event);
+	// Write a scaled-down viewport capture at first contentful paint.
+	void setPreview(const QString& path, int width);
+	// Extra regions written as separate outputs from the same loaded page.
+	void addClip(const QRect& rect);
+	void addClipSelector(const QString& selector);
+	// Also capture child frames matching selector ("all" for every frame),
+	// optionally with each frame's "html" or "text".
+	void setFrames(const QString& selector, const QString& content);
+	// Add a labelled thumbnail of every raster output to shared contact
+	// sheets <path>-1.png, <path>-2.png, ... holding columns x rows each.
+	void setContactSheet(const QString& path, int columns, int rows, int thumbWidth);
+	void setRenderProfile(RenderProfile profile);
+	// SVG as tiles in format ("png", "webp", "jpeg"; empty paints through
+	// QSvgGenerator), optionally with selectable text runs on top.
+	void setSvgTiles(const QString& format, int size, bool text);
+	// Prepended to every metrics key this capture records.
+	void setMetricsPrefix(const QString& prefix);
+	// Palette-reduce raster output to at most colors entries; 0 disables.
+	void setQuantize(int colors, bool dither);
+
+signals:
+	// The main raster output after post-processing.
+	void captured(const QImage& image);
+	// All outputs are written (or failed); code is the process exit code.
+	void finished(int code);
+
 public slots:
 	void Timeout();
 	void pdfPrintFinish(const QString& filePath, bool success);
 	void DocumentComplete(bool ok);
 	void onContentsSizeChanged(const QSizeF& size);
+	void LifecycleEvent(const QString& name);
+	void LoadStarted();
+	void PhaseTimeout();
 
 private slots:
 	void Delayed();
@@ -143,7 +306,45 @@ private slots:
 private:
 	void TryDelayedRender();
 	void saveSnapshot();
+	QImage saveRaster(const QImage& grabbed, QString out, const char* format);
+	void saveClips(const QString& out, const char* format);
+	void saveFrames(const QString& out, const char* format);
+	void saveScreenshot(const QString& out, const char* format);
+	void saveSvg(const QString& out);
+	bool writeSvg(const QImage& image, const QString& out, const QVariantList& runs, double unit,
+	              const QPointF& origin);
+	void captureRegion(const QRect& rect, const std::function<void(const QImage&)>& done);
+	void devToolsScreenshot(const QRect& rect, const char* format,
+	                        const std::function<void(const QByteArray&)>& done);
+	// Grow the widget the usual way and capture again once DevTools is gone.
+	void recaptureWithoutDevTools();
+	QRect pageRect() const;
+	QRect fromCss(const QRectF& rect) const;
+	bool needsImage() const;
+	// Outputs written by asynchronous callbacks; quit when the last is done.
+	void finishStage();
+	void enterPhase(Phase phase);
+	void checkCpu();
+	// The renderer is stopped; write the last frame the widget shows.
+	void saveFrozenFrame(const QString& out);
+	void captureDeadline();
+	void done(int code);
+	void finishRecordings(int code);
+	void metric(const QString& key, const QJsonValue& value);
+	void markMetric(const QString& key);
+	void savePreview();
+	bool recordHash(const QImage& image, const QString& out);
+	void addToContactSheet(const QImage& image, const QString& out);
+	QImage grabImage();
+	// trimmed receives the top left of what autotrim kept.
+	QImage postProcess(QImage image, QPoint* trimmed = nullptr);
+	const char* chooseFormat(QImage& image, int& quality);
+	bool writeImage(const QImage& image, const QString& path, const char* format,
+	                int quality = -1);
+	bool writeJpeg(const QImage& image, const QString& path);
 	void updateViewportToContentThenMaybeCapture();
+	void measureContentSize();
+	QSize clampedSize(const QSize& size) const;
 
 #if CUTYCAPT_SCRIPT
 	void wireScriptSignals();
@@ -162,10 +363,201 @@ private:
 	bool mSawGeometryChange{ false };
 
 	QSize mViewSize;
+	bool mFullPage{ true };
+	int mMaxHeight{ 0 };
+	int mSizingPasses{ 4 };
+	int mSizingPass{ 0 };
+	int mAutotrim{ -1 };
+	ColorMode mColorMode{ RgbColor };
+	int mThreshold{ OtsuThreshold };
+	int mQuantize{ 0 };
+	bool mDither{ false };
+	RenderProfile mRenderProfile{ DefaultRender };
+	QString mSvgTiles;
+	int mSvgTileSize{ 512 };
+	bool mSvgText{ false };
+	QString mMetricsPrefix;
+	bool mDone{ false };
+	QList<QRect> mClips;
+	QStringList mClipSelectors;
+	QString mFrames;
+	QString mFrameContent;
+	int mPendingStages{ 0 };
+	QString mContactSheet;
+	int mContactColumns{ 6 };
+	int mContactRows{ 8 };
+	int mContactThumb{ 240 };
+	QString mWaitUntil;
+	CutyWarc* mWarc{ nullptr };
+	CutyTrace* mTrace{ nullptr };
+	CutyDevTools* mDevTools{ nullptr };
+	double mScale{ 1.0 };
+	bool mRecapturing{ false };
+	int mPhaseBudget[PhaseCount]{};
+	PhasePolicy mPhasePolicy[PhaseCount]{ FailPolicy, FailPolicy, FailPolicy, CapturePolicy };
+	Phase mPhase{ FirstBytePhase };
+	QTimer mPhaseTimer;
+	QWebEngineHttpRequest mRequest;
+	int mRetries{ 0 };
+	int mAttempt{ 0 };
+	// Loads are numbered in the order they start; the current attempt's
+	// load is mAttemptLoad.
+	int mLoadsStarted{ 0 };
+	int mLoadsFinished{ 0 };
+	int mAttemptLoad{ 1 };
+	int mCpuBudget{ 0 };
+	PhasePolicy mCpuPolicy{ CapturePolicy };
+	QTimer mCpuTimer;
+	QHash<qint64, qint64> mCpuByPid;
+	bool mCpuExceeded{ false };
+	qint64 mFrozenPid{ 0 };
+	QTimer mDeadlineTimer;
+	bool mCaptureStarted{ false };
+	QString mPreview;
+	int mPreviewWidth{ 480 };
+	bool mPreviewDone{ false };
+	bool mRecompress{ false };
+	bool mPhashSidecar{ false };
+	QString mPhashIndex;
+	int mPhashDistance{ 8 };
+	bool mSkipDuplicates{ false };
+	int mJpegQuality{ 75 };
+	int mJpegSubsampling{ 420 };
+	bool mJpegProgressive{ false };
+	bool mJpegOptimize{ false };
 	bool mInsecure{ false };
 	bool mSmooth{ false };
 	bool mSilent{ false };
 
 public:
 	QTimer mTimeoutTimer;
-};
\ No newline at end of file
+};
+
+// Two captures in one process (--url-b); once both are finished their
+// raster outputs are aligned and diffed.
+class CutyCompare : public QObject {
+	Q_OBJECT
+public:
+	CutyCompare(CutyCapt* a, CutyCapt* b, const QString& diffPath, int tolerance, bool silent);
+
+private:
+	void finish(int index, int code);
+
+	QImage mImages[2];
+	bool mFinished[2]{ false, false };
+	QString mDiffPath;
+	int mTolerance{ 0 };
+	int mCode{ 0 };
+	bool mSilent{ false };
+};
+
+// Minimal Chrome DevTools Protocol client for one page, over Chromium's
+// loopback remote-debugging endpoint: a WebSocket on QTcpSocket carrying
+// unfragmented text frames.
+class CutyDevTools : public QObject {
+	Q_OBJECT
+public:
+	using Callback = std::function<void(const QJsonObject& result)>;
+
+	CutyDevTools(quint16 port, QWebEnginePage* page, QObject* parent = nullptr);
+
+	// Find the page's target and connect; ends in ready() or failed().
+	void open();
+	bool isOpen() const;
+	// done receives the command's result, or an empty object on error.
+	void send(const QString& method, const QJsonObject& params = QJsonObject(),
+	          const Callback& done = Callback());
+
+signals:
+	void ready();
+	void failed(const QString& reason);
+	void eventReceived(const QString& method, const QJsonObject& params);
+
+private:
+	void discover(int attempt);
+	void readSocket();
+	// Close, answer commands still waiting with nothing, report reason.
+	void fail(const QString& reason);
+	void sendFrame(int opcode, const QByteArray& payload);
+	void dispatch(const QByteArray& message);
+
+	quint16 mPort{ 0 };
+	QWebEnginePage* mPage{ nullptr };
+	QTcpSocket mSocket;
+	QByteArray mKey;
+	QByteArray mBuffer;
+	QByteArray mMessage;
+	bool mOpen{ false };
+	int mNextId{ 1 };
+	QHash<int, Callback> mPending;
+};
+
+// Records the page's HTTP exchanges from DevTools Network events into a
+// WARC file. Payloads whose digest is already in the shared index become
+// revisit records.
+class CutyWarc : public QObject {
+	Q_OBJECT
+public:
+	CutyWarc(CutyDevTools* devTools, const QString& path, const QString& index, bool silent,
+	         QObject* parent = nullptr);
+
+	// Open the file and enable the Network domain, then call started.
+	void start(const std::function<void()>& started);
+	// Write what is still in flight (briefly), close and call done.
+	void finish(const std::function<void()>& done);
+
+private:
+	struct Exchange {
+		QJsonObject request;
+		QJsonObject response;
+		QString date;
+	};
+
+	void onEvent(const QString& method, const QJsonObject& params);
+	void record(const Exchange& exchange, const QByteArray& body, bool transcoded = false);
+	QByteArray writeRecord(const QByteArray& type, const QString& uri, const QString& date,
+	                       const QList<QByteArray>& fields, const QByteArray& block);
+	bool closeIfSettled();
+	void close();
+
+	CutyDevTools* mDevTools{ nullptr };
+	QString mPath;
+	QString mIndex;
+	QFile mFile;
+	bool mGzip{ false };
+	bool mSilent{ false };
+	QHash<QString, Exchange> mExchanges;
+	// Payload digest -> "<date> <uri>" of the record holding it.
+	QHash<QByteArray, QByteArray> mDigests;
+	QList<QByteArray> mNewDigests;
+	int mPendingBodies{ 0 };
+	int mRecords{ 0 };
+	int mRevisits{ 0 };
+	std::function<void()> mDone;
+};
+
+// Chromium trace of the capture through the DevTools Tracing domain,
+// streamed to a JSON trace event file (chrome://tracing, Perfetto).
+class CutyTrace : public QObject {
+	Q_OBJECT
+public:
+	CutyTrace(CutyDevTools* devTools, const QString& path, const QStringList& categories,
+	          bool silent, QObject* parent = nullptr);
+
+	// Open the file and start tracing, then call started.
+	void start(const std::function<void()>& started);
+	// Stop tracing, wait for the buffered events, close and call done.
+	void finish(const std::function<void()>& done);
+
+private:
+	void onEvent(const QString& method, const QJsonObject& params);
+	void close();
+
+	CutyDevTools* mDevTools{ nullptr };
+	QString mPath;
+	QStringList mCategories;
+	QFile mFile;
+	bool mSilent{ false };
+	qint64 mEvents{ 0 };
+	std::function<void()> mDone;
+};
@@ -0,0 +1,88 @@
+#!/bin/sh
+# Training run for profile-guided optimization.
+#
+#   cmake -S . -B build -DCUTYCAPT_PGO=GENERATE && cmake --build build
+#   pgo/train.sh build
+#   cmake -S . -B build -DCUTYCAPT_PGO=USE && cmake --build build
+#
+# Captures every page in pgo/corpus in each output format, then again with
+# the in-process image options (trimming, colour reduction, quantization,
+# automatic format choice, hashing, comparison and recompression), so the
+# profile covers option handling, capture orchestration, the encoders and
+# the filters.
+
+set -eu
+
+build=${1:?usage: $0 <build-dir> [extra cutycapt options...]}
+shift
+here=$(cd "$(dirname "$0")" && pwd)
+cutycapt="$build/cutycapt"
+profile=${CUTYCAPT_PGO_DIR:-$build/pgo-profile}
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+if [ ! -x "$cutycapt" ]; then
+	echo "$cutycapt not found; build with -DCUTYCAPT_PGO=GENERATE first" >&2
+	exit 1
+fi
+
+run=""
+if [ -z "${DISPLAY:-}" ] && [ -z "${QT_QPA_PLATFORM:-}" ]; then
+	run="xvfb-run -a"
+fi
+
+mkdir -p "$profile"
+for page in "$here"/corpus/*.html; do
+	name=$(basename "$page" .html)
+	for ext in png jpeg svg pdf html txt; do
+		echo "training: $name.$ext"
+		$run "$cutycapt" --url="file://$page" --out="$out/$name.$ext" \
+			--max-wait=30000 --silent --metrics="$out/$name.$ext.json" "$@" ||
+			echo "warning: $name.$ext failed" >&2
+	done
+done
+
+# One line per run: a label, the output extension, then cutycapt options.
+# "@other" stands for another corpus page, "@index" for a shared file.
+options=$(cat <<'EOF'
+trim png --autotrim=8
+gray png --color=gray
+bilevel png --color=bilevel:otsu
+adaptive png --color=bilevel:adaptive
+png8 png --quantize=64
+dither gif --quantize=256 --dither
+gif gif
+auto auto
+phash png --phash --phash-index=@index
+compare png --url-b=@other --diff-tolerance=4
+jpeg444 jpeg --jpeg-subsampling=444 --jpeg-progressive --jpeg-optimize
+tiles svg --svg-tiles=png --svg-text
+compact png --render-profile=compact --quantize=256
+EOF
+)
+
+for page in "$here"/corpus/*.html; do
+	name=$(basename "$page" .html)
+	other=$(ls "$here"/corpus/*.html | grep -v "/$name.html\$" | head -n 1)
+	echo "$options" | while read -r label ext opts; do
+		opts=$(echo "$opts" | sed "s|@index|$out/phash.index|; s|@other|file://$other|")
+		echo "training: $name $label"
+		# shellcheck disable=SC2086
+		$run "$cutycapt" --url="file://$page" --out="$out/$name-$label.$ext" \
+			--max-wait=30000 --silent $opts "$@" ||
+			echo "warning: $name $label failed" >&2
+	done
+
+	# The optimal PNG rewrite --recompress starts in the background, run
+	# in the foreground so its profile is written before merging.
+	echo "training: $name recompress"
+	"$cutycapt" --recompress-png="$out/$name.png" --silent ||
+		echo "warning: $name recompress failed" >&2
+done
+
+# Clang writes raw profiles that must be merged before the USE build.
+if ls "$profile"/*.profraw >/dev/null 2>&1; then
+	llvm-profdata merge -output="$profile/cutycapt.profdata" "$profile"/*.profraw
+fi
+
+echo "profile data in $profile"